@@ -19,19 +19,51 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <glob.h>
+#include <yajl/yajl_parse.h>
 
 #include "util.h"
 #include "alpm-query.h"
 
 #define ARCH_PACKAGES_URL "https://www.archlinux.org/packages/"
+#define ARCH_FLAGGED_URL ARCH_PACKAGES_URL "search/json/?flagged=Flagged&page="
 #define OUTOFDATE_FLAG "\"flag_date\": "
 
-typedef const char *(*retcharfn) (void *);
+/* The flagged list is downloaded (about 15 pages) once more than
+ * FLAGGED_SINGLE_MAX packages are looked up, FLAGGED_JOBS pages at a time */
+#define FLAGGED_SINGLE_MAX 8
+#define FLAGGED_JOBS 4
+
+/* Flagged packages, keys are "repo/name" */
+typedef enum {
+	FLAGGED_UNKNOWN,
+	FLAGGED_OK,
+	FLAGGED_FAILED
+} flagged_state_t;
+
+static hash_t *flagged_pkgs = NULL;
+static arena_t *flagged_arena = NULL;
+static flagged_state_t flagged_state = FLAGGED_UNKNOWN;
+static unsigned int flagged_lookups = 0;
+
+/* One page of the packages search */
+typedef struct _flagged_json_t
+{
+	yajl_handle hand;
+	int level;
+	enum { F_KEY_NONE, F_KEY_NUM_PAGES, F_KEY_PKGNAME, F_KEY_REPO } key;
+	char *pkgname;
+	char *repo;
+	unsigned int num_pages;
+	bool error;
+} flagged_json_t;
 
 /* from pacman */
 static void setarch(const char *arch)
@@ -209,14 +241,33 @@ bool init_db_sync (void)
 	return parse_configfile (NULL, config.configfile, true);
 }
 
+/* Sync packages by name, first database wins */
+static hash_t *sync_pkgs = NULL;
+
+static void sync_pkgs_build (void)
+{
+	const alpm_list_t *dbs = alpm_get_syncdbs (config.handle);
+	size_t count = 0;
+	for (const alpm_list_t *i = dbs; i; i = alpm_list_next (i)) {
+		count += alpm_list_count (alpm_db_get_pkgcache (i->data));
+	}
+	sync_pkgs = hash_new (count);
+	for (const alpm_list_t *i = dbs; i; i = alpm_list_next (i)) {
+		for (const alpm_list_t *j = alpm_db_get_pkgcache (i->data); j; j = alpm_list_next (j)) {
+			const char *pkgname = alpm_pkg_get_name (j->data);
+			if (!hash_get (sync_pkgs, pkgname)) {
+				hash_add (sync_pkgs, pkgname, j->data);
+			}
+		}
+	}
+}
+
 static alpm_pkg_t *get_sync_pkg_by_name (const char *pkgname)
 {
-	alpm_pkg_t *sync_pkg = NULL;
-	for (const alpm_list_t *i = alpm_get_syncdbs (config.handle); i; i = alpm_list_next (i)) {
-		sync_pkg = alpm_db_get_pkg (i->data, pkgname);
-		if (sync_pkg) break;
+	if (!sync_pkgs) {
+		sync_pkgs_build ();
 	}
-	return sync_pkg;
+	return hash_get (sync_pkgs, pkgname);
 }
 
 /* get_sync_pkg() returns the first pkg with same name in sync dbs */
@@ -229,31 +280,243 @@ static alpm_pkg_t *get_sync_pkg (alpm_pkg_t *pkg)
 	return pkg;
 }
 
+/* Reverse dependencies of a local package */
+typedef struct _revdeps_t
+{
+	alpm_pkg_t *pkg;
+	alpm_list_t *requiredby;  /* names, in arena */
+	alpm_list_t *optionalfor;
+} revdeps_t;
+
+/* A local package providing a name */
+typedef struct _provider_t
+{
+	revdeps_t *rd;
+	const alpm_depend_t *provision;
+	struct _provider_t *next;
+} provider_t;
+
+static hash_t *local_revdeps = NULL;
+static arena_t *revdeps_arena = NULL;
+
+/* dep_vercmp() and the checks below are libalpm dependency rules */
+static bool dep_vercmp (const char *version1, alpm_depmod_t mod, const char *version2)
+{
+	if (mod == ALPM_DEP_MOD_ANY) {
+		return true;
+	}
+	if (!version1 || !version2) {
+		return false;
+	}
+	const int cmp = alpm_pkg_vercmp (version1, version2);
+	switch (mod) {
+		case ALPM_DEP_MOD_EQ: return cmp == 0;
+		case ALPM_DEP_MOD_GE: return cmp >= 0;
+		case ALPM_DEP_MOD_LE: return cmp <= 0;
+		case ALPM_DEP_MOD_LT: return cmp < 0;
+		case ALPM_DEP_MOD_GT: return cmp > 0;
+		default: return true;
+	}
+}
+
+static void revdeps_link (revdeps_t *rd, const char *name, bool optional)
+{
+	alpm_list_t **list = (optional) ? &(rd->optionalfor) : &(rd->requiredby);
+	/* packages are walked in order, so a duplicate is the last one */
+	if (!*list || (*list)->prev->data != name) {
+		*list = arena_list_add (revdeps_arena, *list, (void *) name);
+	}
+}
+
+static void revdeps_add (alpm_pkg_t *pkg, const alpm_list_t *deps, bool optional,
+                         const hash_t *providers)
+{
+	const char *name = alpm_pkg_get_name (pkg);
+	for (const alpm_list_t *d = deps; d; d = alpm_list_next (d)) {
+		const alpm_depend_t *dep = d->data;
+		revdeps_t *rd = hash_get (local_revdeps, dep->name);
+		if (rd && dep_vercmp (alpm_pkg_get_version (rd->pkg), dep->mod, dep->version)) {
+			revdeps_link (rd, name, optional);
+		}
+		for (const provider_t *pr = hash_get (providers, dep->name); pr; pr = pr->next) {
+			if (dep->mod == ALPM_DEP_MOD_ANY || (pr->provision->mod == ALPM_DEP_MOD_EQ &&
+					dep_vercmp (pr->provision->version, dep->mod, dep->version))) {
+				revdeps_link (pr->rd, name, optional);
+			}
+		}
+	}
+}
+
+/* revdeps_build() resolves depends and optdepends of all local packages
+ * at once, instead of a database walk per package */
+static void revdeps_build (void)
+{
+	const alpm_list_t *pkgs = alpm_db_get_pkgcache (alpm_get_localdb (config.handle));
+	const size_t count = alpm_list_count (pkgs);
+	local_revdeps = hash_new (count);
+	revdeps_arena = arena_new ();
+	hash_t *providers = hash_new (count);
+
+	for (const alpm_list_t *i = pkgs; i; i = alpm_list_next (i)) {
+		revdeps_t *rd = arena_alloc (revdeps_arena, sizeof (revdeps_t));
+		rd->pkg = i->data;
+		hash_add (local_revdeps, alpm_pkg_get_name (rd->pkg), rd);
+		for (const alpm_list_t *j = alpm_pkg_get_provides (rd->pkg); j; j = alpm_list_next (j)) {
+			provider_t *pr = arena_alloc (revdeps_arena, sizeof (provider_t));
+			pr->rd = rd;
+			pr->provision = j->data;
+			pr->next = hash_get (providers, pr->provision->name);
+			hash_add (providers, pr->provision->name, pr);
+		}
+	}
+
+	for (const alpm_list_t *i = pkgs; i; i = alpm_list_next (i)) {
+		revdeps_add (i->data, alpm_pkg_get_depends (i->data), false, providers);
+		revdeps_add (i->data, alpm_pkg_get_optdepends (i->data), true, providers);
+	}
+
+	hash_free (providers);
+}
+
+/* revdeps_get() returns NULL if pkg is not a local package */
+static const revdeps_t *revdeps_get (alpm_pkg_t *pkg)
+{
+	alpm_db_t *localdb = alpm_get_localdb (config.handle);
+	if (!pkg || alpm_pkg_get_origin (pkg) != ALPM_PKG_FROM_LOCALDB ||
+			alpm_pkg_get_db (pkg) != localdb) {
+		return NULL;
+	}
+	if (!local_revdeps) {
+		revdeps_build ();
+	}
+	return hash_get (local_revdeps, alpm_pkg_get_name (pkg));
+}
+
+/* pkg_compute_requiredby() is alpm_pkg_compute_requiredby(),
+ * or alpm_pkg_compute_optionalfor() with optional */
+static alpm_list_t *pkg_compute_requiredby (alpm_pkg_t *pkg, bool optional)
+{
+	const revdeps_t *rd = revdeps_get (pkg);
+	if (!rd) {
+		return (optional) ? alpm_pkg_compute_optionalfor (pkg) : alpm_pkg_compute_requiredby (pkg);
+	}
+	alpm_list_t *ret = NULL;
+	for (const alpm_list_t *i = (optional) ? rd->optionalfor : rd->requiredby; i; i = alpm_list_next (i)) {
+		ret = alpm_list_add (ret, strdup (i->data));
+	}
+	return ret;
+}
+
+static bool pkg_is_required (alpm_pkg_t *pkg, bool optional)
+{
+	const revdeps_t *rd = revdeps_get (pkg);
+	if (rd) {
+		return ((optional) ? rd->optionalfor : rd->requiredby) != NULL;
+	}
+	alpm_list_t *requiredby = pkg_compute_requiredby (pkg, optional);
+	const bool ret = (requiredby != NULL);
+	FREELIST (requiredby);
+	return ret;
+}
+
+/* Local packages -> newer sync package */
+static hash_t *upgrades = NULL;
+
+/* upgrades_build() joins local and sync packages by name in one pass */
+static void upgrades_build (void)
+{
+	const alpm_list_t *pkgs = alpm_db_get_pkgcache (alpm_get_localdb (config.handle));
+	upgrades = hash_new_ptr (64);
+	for (const alpm_list_t *i = pkgs; i; i = alpm_list_next (i)) {
+		alpm_pkg_t *pkg = i->data;
+		alpm_pkg_t *sync_pkg = get_sync_pkg_by_name (alpm_pkg_get_name (pkg));
+		if (sync_pkg && alpm_pkg_vercmp (alpm_pkg_get_version (sync_pkg),
+				alpm_pkg_get_version (pkg)) > 0) {
+			hash_add_ptr (upgrades, pkg, sync_pkg);
+		}
+	}
+}
+
+/* get_new_version() is alpm_sync_get_new_version() on all sync dbs */
+static alpm_pkg_t *get_new_version (alpm_pkg_t *pkg)
+{
+	if (alpm_pkg_get_origin (pkg) != ALPM_PKG_FROM_LOCALDB) {
+		return alpm_sync_get_new_version (pkg, alpm_get_syncdbs (config.handle));
+	}
+	if (!upgrades) {
+		upgrades_build ();
+	}
+	return hash_get_ptr (upgrades, pkg);
+}
+
+/*
+ * Costly predicates of filter(), computed once per package
+ */
+#define P_SYNC     (1 << 0) /* in a sync db */
+#define P_REQUIRED (1 << 1)
+#define P_OPTIONAL (1 << 2)
+#define P_UPGRADE  (1 << 3)
+
+typedef struct _pkgstate_t
+{
+	unsigned int known;
+	unsigned int values;
+} pkgstate_t;
+
+/* package -> pkgstate_t */
+static hash_t *pkg_states = NULL;
+static arena_t *pkg_states_arena = NULL;
+
+static bool pkg_predicate (alpm_pkg_t *pkg, unsigned int predicate)
+{
+	switch (predicate) {
+		case P_SYNC:     return get_sync_pkg (pkg) != NULL;
+		case P_REQUIRED: return pkg_is_required (pkg, false);
+		case P_OPTIONAL: return pkg_is_required (pkg, true);
+		case P_UPGRADE:  return get_new_version (pkg) != NULL;
+		default: return false;
+	}
+}
+
+static bool pkg_state (alpm_pkg_t *pkg, unsigned int predicate)
+{
+	/* a package loaded from a file may be freed, its address reused */
+	if (alpm_pkg_get_origin (pkg) == ALPM_PKG_FROM_FILE) {
+		return pkg_predicate (pkg, predicate);
+	}
+
+	if (!pkg_states) {
+		pkg_states = hash_new_ptr (1024);
+		pkg_states_arena = arena_new ();
+	}
+	pkgstate_t *state = hash_get_ptr (pkg_states, pkg);
+	if (!state) {
+		state = arena_alloc (pkg_states_arena, sizeof (pkgstate_t));
+		hash_add_ptr (pkg_states, pkg, state);
+	}
+	if (!(state->known & predicate)) {
+		state->known |= predicate;
+		if (pkg_predicate (pkg, predicate)) {
+			state->values |= predicate;
+		}
+	}
+	return (state->values & predicate) != 0;
+}
+
 static bool filter (alpm_pkg_t *pkg, unsigned int _filter)
 {
-	if ((_filter & F_FOREIGN) && get_sync_pkg (pkg))
+	if ((_filter & F_FOREIGN) && pkg_state (pkg, P_SYNC))
 		return false;
-	if ((_filter & F_NATIVE) && !get_sync_pkg (pkg))
+	if ((_filter & F_NATIVE) && !pkg_state (pkg, P_SYNC))
 		return false;
 	if ((_filter & F_EXPLICIT) && alpm_pkg_get_reason (pkg) != ALPM_PKG_REASON_EXPLICIT)
 		return false;
 	if ((_filter & F_DEPS) && alpm_pkg_get_reason (pkg) != ALPM_PKG_REASON_DEPEND)
 		return false;
-	if (_filter & F_UNREQUIRED) {
-		alpm_list_t *requiredby = alpm_pkg_compute_requiredby (pkg);
-		if (requiredby) {
-			FREELIST (requiredby);
-			return false;
-		}
-		if (!(_filter & F_UNREQUIRED_2)) {
-			requiredby = alpm_pkg_compute_optionalfor (pkg);
-			if (requiredby) {
-				FREELIST (requiredby);
-				return false;
-			}
-		}
-	}
-	if ((_filter & F_UPGRADES) && !alpm_sync_get_new_version (pkg, alpm_get_syncdbs(config.handle)))
+	if ((_filter & F_UNREQUIRED) && (pkg_state (pkg, P_REQUIRED) ||
+			(!(_filter & F_UNREQUIRED_2) && pkg_state (pkg, P_OPTIONAL))))
+		return false;
+	if ((_filter & F_UPGRADES) && !pkg_state (pkg, P_UPGRADE))
 		return false;
 	if ((_filter & F_GROUP) && !alpm_pkg_get_groups (pkg))
 		return false;
@@ -273,67 +536,185 @@ static int filter_state (alpm_pkg_t *pkg)
 	return ret;
 }
 
-unsigned int search_pkg_by_type (alpm_db_t *db, alpm_list_t **targets)
+/* One depends/conflicts/provides/replaces/requiredby entry of a package */
+typedef struct _depentry_t
 {
-	if (!targets) {
-		return 0;
+	alpm_pkg_t *pkg;
+	target_t dep;
+	size_t order;              /* position in database walk */
+	struct _depentry_t *next;  /* same dep name */
+} depentry_t;
+
+/* Entries of a database for one query type, by dep name */
+typedef struct _depindex_t
+{
+	alpm_db_t *db;
+	qtype_t query;
+	hash_t *names;
+	arena_t *arena;
+} depindex_t;
+
+static alpm_list_t *depindexes = NULL;
+
+static void depindex_free (depindex_t *idx)
+{
+	if (idx) {
+		hash_free (idx->names);
+		arena_free (idx->arena);
+		free (idx);
+	}
+}
+
+/* depindex_get() builds the index of db for query on first call */
+static depindex_t *depindex_get (alpm_db_t *db, qtype_t query)
+{
+	for (const alpm_list_t *i = depindexes; i; i = alpm_list_next (i)) {
+		depindex_t *idx = i->data;
+		if (idx->db == db && idx->query == query) {
+			return idx;
+		}
 	}
 
-	unsigned int ret = 0;
 	alpm_list_t *(*f)(alpm_pkg_t *);
-	int free_fn_ret = 0;
-	/* free_fn_ret=1 to free f() return
-	 * free_fn_ret=2 to free g() return
-	 *            =3 to free both
-	 */
-
-	retcharfn g = (retcharfn) alpm_dep_compute_string;
-	free_fn_ret = 2;
-	switch (config.query) {
+	bool requiredby = false;
+	switch (query) {
 		case OP_Q_DEPENDS:   f = alpm_pkg_get_depends; break;
 		case OP_Q_CONFLICTS: f = alpm_pkg_get_conflicts; break;
 		case OP_Q_PROVIDES:  f = alpm_pkg_get_provides; break;
 		case OP_Q_REPLACES:  f = alpm_pkg_get_replaces; break;
 		case OP_Q_REQUIRES:
-			f = alpm_pkg_compute_requiredby;
-			g = NULL;
-			free_fn_ret = 3;
+			/* names from pkg_compute_requiredby(), to free */
+			f = NULL;
+			requiredby = true;
 			break;
-		default: return 0;
+		default: return NULL;
 	}
-	target_arg_t *ta = target_arg_init (NULL, NULL, NULL);
 
-	for (const alpm_list_t *i = alpm_db_get_pkgcache (db); i && *targets; i = alpm_list_next (i)) {
+	depindex_t *idx;
+	MALLOC (idx, sizeof (depindex_t));
+	idx->db = db;
+	idx->query = query;
+	idx->names = hash_new (alpm_list_count (alpm_db_get_pkgcache (db)));
+	idx->arena = arena_new ();
+
+	size_t order = 0;
+	for (const alpm_list_t *i = alpm_db_get_pkgcache (db); i; i = alpm_list_next (i)) {
 		alpm_pkg_t *pkg = i->data;
-		alpm_list_t *pkg_info_list = f (pkg);
-		for (const alpm_list_t *j = pkg_info_list; j && *targets; j = alpm_list_next (j)) {
-			char *str = (char *) ((g) ? g(j->data) : j->data);
-			target_t *t1 = target_parse (str);
-			if (free_fn_ret & 2) {
+		alpm_list_t *pkg_info_list = (requiredby) ? pkg_compute_requiredby (pkg, false) : f (pkg);
+		for (const alpm_list_t *j = pkg_info_list; j; j = alpm_list_next (j)) {
+			char *str = (requiredby) ? j->data : alpm_dep_compute_string (j->data);
+			target_t *t = target_parse (str);
+			if (!requiredby) {
 				free (str);
 			}
-			for (const alpm_list_t *t = *targets; t; t = alpm_list_next (t)) {
-				target_t *t2 = target_parse (t->data);
-				if (t2 && t2->db && strcmp (t2->db, alpm_db_get_name (db)) != 0) {
-					target_free (t2);
-					continue;
-				}
-				if (target_compatible (t1, t2) && filter (pkg, config.filter)) {
-					ret++;
-					if (target_arg_add (ta, t->data, pkg)) {
-						print_package (t->data, pkg, alpm_pkg_get_str);
-					}
-				}
-				target_free (t2);
+			depentry_t *entry = arena_alloc (idx->arena, sizeof (depentry_t));
+			entry->pkg = pkg;
+			entry->order = order++;
+			entry->dep.name = arena_strndup (idx->arena, t->name, strlen (t->name));
+			entry->dep.mod = t->mod;
+			if (t->ver) {
+				entry->dep.ver = arena_strndup (idx->arena, t->ver, strlen (t->ver));
 			}
-			*targets = target_arg_clear (ta, *targets);
-			target_free (t1);
+			target_free (t);
+			/* chains are in reverse order, matches are sorted anyway */
+			entry->next = hash_get (idx->names, entry->dep.name);
+			hash_add (idx->names, entry->dep.name, entry);
+		}
+		if (requiredby) {
+			FREELIST (pkg_info_list);
+		}
+	}
+
+	depindexes = alpm_list_add (depindexes, idx);
+	return idx;
+}
+
+/* A target matching an entry */
+typedef struct _depmatch_t
+{
+	const depentry_t *entry;
+	size_t target;
+	const char *arg;
+} depmatch_t;
+
+static int depmatch_cmp (const void *p1, const void *p2)
+{
+	const depmatch_t *m1 = p1;
+	const depmatch_t *m2 = p2;
+	if (m1->entry->order != m2->entry->order) {
+		return (m1->entry->order < m2->entry->order) ? -1 : 1;
+	}
+	return (m1->target < m2->target) ? -1 : (m1->target > m2->target);
+}
+
+unsigned int search_pkg_by_type (alpm_db_t *db, alpm_list_t **targets)
+{
+	if (!targets) {
+		return 0;
+	}
+
+	const depindex_t *idx = depindex_get (db, config.query);
+	if (!idx) {
+		return 0;
+	}
+
+	/* matches are sorted in database order, as if packages were walked */
+	depmatch_t *matches = NULL;
+	size_t count = 0, size = 0;
+	const size_t targets_count = alpm_list_count (*targets);
+	size_t k = 0;
+	for (const alpm_list_t *t = *targets; t; t = alpm_list_next (t), k++) {
+		target_t *t2 = target_parse (t->data);
+		if (t2->db && strcmp (t2->db, alpm_db_get_name (db)) != 0) {
+			target_free (t2);
+			continue;
+		}
+		for (const depentry_t *e = hash_get (idx->names, t2->name); e; e = e->next) {
+			if (!target_compatible (&(e->dep), t2)) {
+				continue;
+			}
+			if (count == size) {
+				size = (size) ? size * 2 : 16;
+				REALLOC (matches, size * sizeof (depmatch_t));
+			}
+			matches[count].entry = e;
+			matches[count].target = k;
+			matches[count].arg = t->data;
+			count++;
+		}
+		target_free (t2);
+	}
+	qsort (matches, count, sizeof (depmatch_t), depmatch_cmp);
+
+	/* with --just-one, a target found is not looked for in next entries */
+	size_t *found_at;
+	MALLOC (found_at, (targets_count + 1) * sizeof (size_t));
+	for (k = 0; k < targets_count; k++) {
+		found_at[k] = SIZE_MAX;
+	}
+
+	unsigned int ret = 0;
+	target_arg_t *ta = target_arg_init (NULL, NULL, NULL);
+	for (size_t m = 0; m < count; m++) {
+		const depmatch_t *match = matches + m;
+		alpm_pkg_t *pkg = match->entry->pkg;
+		if (config.just_one && found_at[match->target] < match->entry->order) {
+			continue;
 		}
-		if (free_fn_ret & 1) {
-			alpm_list_free (pkg_info_list);
+		if (filter (pkg, config.filter)) {
+			ret++;
+			if (found_at[match->target] == SIZE_MAX) {
+				found_at[match->target] = match->entry->order;
+			}
+			if (target_arg_add (ta, match->arg, pkg)) {
+				print_package (match->arg, pkg, alpm_pkg_get_str);
+			}
 		}
 	}
 	*targets = target_arg_close (ta, *targets);
+
+	free (found_at);
+	free (matches);
 	return ret;
 }
 
@@ -391,16 +772,13 @@ unsigned int list_grp (alpm_db_t *db, alpm_list_t *targets)
 	return ret;
 }
 
-unsigned int search_pkg (alpm_db_t *db, alpm_list_t *targets)
+/* search_pkg_add() shows packages found by alpm_db_search() and frees pkgs */
+static unsigned int search_pkg_add (alpm_list_t *pkgs)
 {
 	unsigned int ret = 0;
-	alpm_list_t *pkgs = NULL;
-	alpm_db_search (db, targets, &pkgs);
 	for (const alpm_list_t *t = pkgs; t; t = alpm_list_next (t)) {
 		alpm_pkg_t *info = t->data;
-		if (!filter (info, config.filter) ||
-				(config.name_only &&
-				!does_name_contain_targets (targets, alpm_pkg_get_name (info), true)))
+		if (!filter (info, config.filter))
 			continue;
 		ret++;
 		print_or_add_result (info, R_ALPM_PKG);
@@ -409,22 +787,256 @@ unsigned int search_pkg (alpm_db_t *db, alpm_list_t *targets)
 	return ret;
 }
 
+/* Package names of a database, packed for --nameonly search */
+typedef struct _nameindex_t
+{
+	alpm_db_t *db;
+	char *names;        /* "name\0name\0..." in pkgcache order */
+	alpm_pkg_t **pkgs;
+	size_t count;
+} nameindex_t;
+
+static alpm_list_t *nameindexes = NULL;
+
+static void nameindex_free (nameindex_t *idx)
+{
+	if (idx) {
+		free (idx->names);
+		free (idx->pkgs);
+		free (idx);
+	}
+}
+
+/* nameindex_get() builds the index of db on first call */
+static nameindex_t *nameindex_get (alpm_db_t *db)
+{
+	for (const alpm_list_t *i = nameindexes; i; i = alpm_list_next (i)) {
+		nameindex_t *idx = i->data;
+		if (idx->db == db) {
+			return idx;
+		}
+	}
+
+	const alpm_list_t *pkgcache = alpm_db_get_pkgcache (db);
+	nameindex_t *idx;
+	MALLOC (idx, sizeof (nameindex_t));
+	idx->db = db;
+	idx->count = alpm_list_count (pkgcache);
+	CALLOC (idx->pkgs, idx->count + 1, sizeof (alpm_pkg_t *));
+	size_t size = 1;
+	for (const alpm_list_t *i = pkgcache; i; i = alpm_list_next (i)) {
+		size += strlen (alpm_pkg_get_name (i->data)) + 1;
+	}
+	MALLOC (idx->names, size);
+	char *p = idx->names;
+	size_t k = 0;
+	for (const alpm_list_t *i = pkgcache; i; i = alpm_list_next (i), k++) {
+		const char *pkgname = alpm_pkg_get_name (i->data);
+		const size_t len = strlen (pkgname);
+		memcpy (p, pkgname, len + 1);
+		p += len + 1;
+		idx->pkgs[k] = i->data;
+	}
+
+	nameindexes = alpm_list_add (nameindexes, idx);
+	return idx;
+}
+
+/* db_searchable() is the usage check done by alpm_db_search() */
+static bool db_searchable (alpm_db_t *db)
+{
+	int usage = 0;
+	return alpm_db_get_usage (db, &usage) == 0 && (usage & ALPM_DB_USAGE_SEARCH);
+}
+
+/* alpm_db_search() finds nothing without targets */
+static bool search_has_target (const alpm_list_t *targets)
+{
+	for (const alpm_list_t *t = targets; t; t = alpm_list_next (t)) {
+		if (t->data) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* search_pkg_name() is search_pkg() with --nameonly, descriptions are not read */
+static unsigned int search_pkg_name (alpm_db_t *db, const matcher_t *matcher)
+{
+	if (!db_searchable (db)) {
+		return 0;
+	}
+	const nameindex_t *idx = nameindex_get (db);
+	unsigned int ret = 0;
+	const char *pkgname = idx->names;
+	for (size_t k = 0; k < idx->count; k++) {
+		if (matcher_match (matcher, pkgname, NULL) && filter (idx->pkgs[k], config.filter)) {
+			ret++;
+			print_or_add_result (idx->pkgs[k], R_ALPM_PKG);
+		}
+		pkgname += strlen (pkgname) + 1;
+	}
+	return ret;
+}
+
+unsigned int search_pkg (alpm_db_t *db, alpm_list_t *targets)
+{
+	if (config.name_only) {
+		if (!search_has_target (targets)) {
+			return 0;
+		}
+		matcher_t *matcher = matcher_new (targets, true);
+		const unsigned int ret = search_pkg_name (db, matcher);
+		matcher_free (matcher);
+		return ret;
+	}
+	alpm_list_t *pkgs = NULL;
+	alpm_db_search (db, targets, &pkgs);
+	return search_pkg_add (pkgs);
+}
+
+#define SEARCH_MAX_THREADS 8
+
+/* Package fields read by search workers.
+ * alpm accessors set handle->pm_errno and may load data, so
+ * they are called on the main thread only, workers just read these.
+ */
+typedef struct _searchpkg_t
+{
+	alpm_pkg_t *pkg;
+	const char *name;
+	const char *desc;
+	const alpm_list_t *provides;
+	const alpm_list_t *groups;
+	bool matched;
+} searchpkg_t;
+
+/* Searches of search_pkg_dbs(), taken in turn by workers */
+typedef struct _dbsearch_t
+{
+	searchpkg_t **pkgs;
+	size_t *counts;
+	size_t count;
+	size_t next;
+	const matcher_t *matcher;
+} dbsearch_t;
+
+static void *search_pkg_worker (void *data)
+{
+	dbsearch_t *search = (dbsearch_t *) data;
+	size_t k;
+	while ((k = __atomic_fetch_add (&(search->next), 1, __ATOMIC_RELAXED)) < search->count) {
+		for (size_t i = 0; i < search->counts[k]; i++) {
+			searchpkg_t *sp = search->pkgs[k] + i;
+			/* regexec() on a shared regex_t is thread safe */
+			sp->matched = matcher_match_pkg (search->matcher, sp->name, sp->desc,
+					sp->provides, sp->groups);
+		}
+	}
+	return NULL;
+}
+
+unsigned int search_pkg_dbs (const alpm_list_t *dbs, alpm_list_t *targets)
+{
+	dbsearch_t search = {NULL, NULL, alpm_list_count (dbs), 0, NULL};
+	if (config.name_only) {
+		if (!search_has_target (targets)) {
+			return 0;
+		}
+		/* name scans are cheap, no need for threads */
+		unsigned int ret = 0;
+		matcher_t *matcher = matcher_new (targets, true);
+		for (const alpm_list_t *i = dbs; i; i = alpm_list_next (i)) {
+			ret += search_pkg_name (i->data, matcher);
+		}
+		matcher_free (matcher);
+		return ret;
+	}
+	if (search.count < 2) {
+		return (dbs) ? search_pkg (dbs->data, targets) : 0;
+	}
+	if (!search_has_target (targets)) {
+		return 0;
+	}
+
+	CALLOC (search.pkgs, search.count, sizeof (searchpkg_t *));
+	CALLOC (search.counts, search.count, sizeof (size_t));
+	size_t k = 0;
+	for (const alpm_list_t *i = dbs; i; i = alpm_list_next (i), k++) {
+		if (!db_searchable (i->data)) {
+			continue;
+		}
+		const alpm_list_t *pkgcache = alpm_db_get_pkgcache (i->data);
+		CALLOC (search.pkgs[k], alpm_list_count (pkgcache) + 1, sizeof (searchpkg_t));
+		for (const alpm_list_t *j = pkgcache; j; j = alpm_list_next (j)) {
+			searchpkg_t *sp = search.pkgs[k] + search.counts[k]++;
+			sp->pkg = j->data;
+			sp->name = alpm_pkg_get_name (sp->pkg);
+			sp->desc = alpm_pkg_get_desc (sp->pkg);
+			sp->provides = alpm_pkg_get_provides (sp->pkg);
+			sp->groups = alpm_pkg_get_groups (sp->pkg);
+		}
+	}
+	matcher_t *matcher = matcher_new (targets, true);
+	search.matcher = matcher;
+
+	size_t nthreads = search.count;
+	const long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && nthreads > (size_t) cpus) {
+		nthreads = cpus;
+	}
+	if (nthreads > SEARCH_MAX_THREADS) {
+		nthreads = SEARCH_MAX_THREADS;
+	}
+	pthread_t threads[SEARCH_MAX_THREADS];
+	size_t started = 0;
+	while (started + 1 < nthreads &&
+			pthread_create (threads + started, NULL, search_pkg_worker, &search) == 0) {
+		started++;
+	}
+	search_pkg_worker (&search);
+	for (size_t w = 0; w < started; w++) {
+		pthread_join (threads[w], NULL);
+	}
+	matcher_free (matcher);
+
+	/* filters and output are done here, in databases then pkgcache order
+	 * like alpm_db_search() returns them */
+	unsigned int ret = 0;
+	for (k = 0; k < search.count; k++) {
+		for (size_t i = 0; i < search.counts[k]; i++) {
+			const searchpkg_t *sp = search.pkgs[k] + i;
+			if (sp->matched && filter (sp->pkg, config.filter)) {
+				ret++;
+				print_or_add_result (sp->pkg, R_ALPM_PKG);
+			}
+		}
+		free (search.pkgs[k]);
+	}
+
+	free (search.pkgs);
+	free (search.counts);
+	return ret;
+}
+
 unsigned int alpm_search_local (unsigned short _filter, const char *format, alpm_list_t **res)
 {
 	unsigned int ret = 0;
+	format_t *fmt = (res) ? format_new ((format) ? format : "%n") : NULL;
 	for (const alpm_list_t *i = alpm_db_get_pkgcache (alpm_get_localdb(config.handle));
 			i; i = alpm_list_next (i)) {
 		alpm_pkg_t *pkg = i->data;
 		if (filter (pkg, _filter)) {
 			if (res) {
 				*res = alpm_list_add (*res,
-						pkg_to_str (NULL, pkg, alpm_pkg_get_str, (format) ? format : "%n"));
+						strdup (pkg_to_str (fmt, NULL, pkg, alpm_pkg_get_str)));
 			} else {
 				print_or_add_result (pkg, R_ALPM_PKG);
 			}
 			ret++;
 		}
 	}
+	format_free (fmt);
 	return ret;
 }
 
@@ -446,6 +1058,10 @@ off_t get_size_pkg (alpm_pkg_t *pkg)
 {
 	alpm_pkg_t *sync_pkg = get_sync_pkg (pkg);
 	if (config.filter & F_UPGRADES) {
+		alpm_pkg_t *new_pkg = get_new_version (pkg);
+		if (new_pkg) {
+			sync_pkg = new_pkg;
+		}
 		if (sync_pkg) {
 			return alpm_pkg_download_size (sync_pkg);
 		}
@@ -457,44 +1073,93 @@ off_t get_size_pkg (alpm_pkg_t *pkg)
 	return 0;
 }
 
+/*
+ * Real size: files are stat'ed relative to the root directory,
+ * by several threads for big packages.
+ */
+#define REALSIZE_THREAD_FILES 4096
+
+static int root_fd = -1;
+
+typedef struct _filestat_t
+{
+	ino_t ino;
+	off_t size;
+	bool counted;
+} filestat_t;
+
+typedef struct _realsize_job_t
+{
+	const alpm_file_t *files;
+	filestat_t *stats;
+} realsize_job_t;
+
+static void realsize_stat (void *data, size_t start, size_t count)
+{
+	const realsize_job_t *job = (const realsize_job_t *) data;
+	for (size_t k = start; k < start + count; k++) {
+		struct stat buf;
+		filestat_t *st = job->stats + k;
+		if (fstatat (root_fd, job->files[k].name, &buf, AT_SYMLINK_NOFOLLOW) == 0 &&
+				(S_ISREG (buf.st_mode) || S_ISLNK (buf.st_mode))) {
+			st->ino = buf.st_ino;
+			st->size = buf.st_size;
+			st->counted = true;
+		}
+	}
+}
+
+static int filestat_ino_cmp (const void *p1, const void *p2)
+{
+	const filestat_t *st1 = (const filestat_t *) p1;
+	const filestat_t *st2 = (const filestat_t *) p2;
+	if (st1->ino != st2->ino) {
+		return (st1->ino < st2->ino) ? -1 : 1;
+	}
+	return 0;
+}
+
 static off_t alpm_pkg_get_realsize (alpm_pkg_t *pkg)
 {
 	const alpm_filelist_t *files = alpm_pkg_get_files (pkg);
-	if (!files) {
+	if (!files || !files->count) {
 		return 0;
 	}
 
-	int ret = chdir (alpm_option_get_root (config.handle));
-	if (ret != 0) {
-		return 0;
+	if (root_fd < 0) {
+		root_fd = open (alpm_option_get_root (config.handle), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (root_fd < 0) {
+			return 0;
+		}
 	}
 
-	off_t size = 0;
-	ino_t inodes[files->count];
-	memset (&inodes, 0, sizeof (inodes));
-	for (size_t k = 0, j = 0; k < files->count; k++) {
-		const alpm_file_t *f = files->files + k;
-		struct stat buf;
-		if (lstat (f->name, &buf) == -1 || !(S_ISREG (buf.st_mode) || S_ISLNK (buf.st_mode))) {
-			continue;
-		}
-		bool found = false;
-		for (size_t i = 0; i < files->count && i < j && !found; i++) {
-			if (inodes[i] == buf.st_ino) {
-				found = true;
-				break;
-			}
+	filestat_t *stats;
+	CALLOC (stats, files->count, sizeof (filestat_t));
+
+	realsize_job_t job = {files->files, stats};
+	threads_run (files->count, REALSIZE_THREAD_FILES, realsize_stat, &job);
+
+	/* hard links are counted once: stat results sorted by inode,
+	 * only the first of each run is added */
+	size_t counted = 0;
+	for (size_t k = 0; k < files->count; k++) {
+		if (stats[k].counted) {
+			stats[counted++] = stats[k];
 		}
-		if (found) {
-			continue;
+	}
+	qsort (stats, counted, sizeof (filestat_t), filestat_ino_cmp);
+	off_t size = 0;
+	for (size_t k = 0; k < counted; k++) {
+		if (k == 0 || stats[k].ino != stats[k-1].ino) {
+			size += stats[k].size;
 		}
-		inodes[j++] = buf.st_ino;
-		size += buf.st_size;
 	}
+
+	free (stats);
 	return size;
 }
 
-static bool alpm_pkg_get_outofdate (alpm_pkg_t *pkg)
+static bool alpm_pkg_fetch_outofdate (alpm_pkg_t *pkg)
 {
 	CURL *curl = curl_init (CURL_GLOBAL_SSL);
 	if (!curl) {
@@ -529,6 +1194,185 @@ static bool alpm_pkg_get_outofdate (alpm_pkg_t *pkg)
 	return flagged;
 }
 
+static int flagged_start_map (void *ctx)
+{
+	((flagged_json_t *) ctx)->level++;
+	return 1;
+}
+
+static int flagged_end_map (void *ctx)
+{
+	flagged_json_t *page = (flagged_json_t *) ctx;
+	if (page->level-- == 2 && page->pkgname && page->repo) {
+		string_t *key = string_new ();
+		string_cat (key, page->repo);
+		string_cat (key, "/");
+		string_cat (key, page->pkgname);
+		char *k = arena_strndup (flagged_arena, string_cstr (key), key->used);
+		hash_add (flagged_pkgs, k, k);
+		string_free (key);
+	}
+	if (page->level == 1) {
+		FREE (page->pkgname);
+		FREE (page->repo);
+	}
+	return 1;
+}
+
+static int flagged_key (void *ctx, const unsigned char *stringVal, size_t stringLen)
+{
+	flagged_json_t *page = (flagged_json_t *) ctx;
+	page->key = F_KEY_NONE;
+	if (page->level == 1 && strncmp ((const char *) stringVal, "num_pages", stringLen) == 0) {
+		page->key = F_KEY_NUM_PAGES;
+	} else if (page->level == 2 && strncmp ((const char *) stringVal, "pkgname", stringLen) == 0) {
+		page->key = F_KEY_PKGNAME;
+	} else if (page->level == 2 && strncmp ((const char *) stringVal, "repo", stringLen) == 0) {
+		page->key = F_KEY_REPO;
+	}
+	return 1;
+}
+
+static int flagged_integer (void *ctx, long long val)
+{
+	flagged_json_t *page = (flagged_json_t *) ctx;
+	if (page->key == F_KEY_NUM_PAGES && val > 0) {
+		page->num_pages = val;
+	}
+	page->key = F_KEY_NONE;
+	return 1;
+}
+
+static int flagged_string (void *ctx, const unsigned char *stringVal, size_t stringLen)
+{
+	flagged_json_t *page = (flagged_json_t *) ctx;
+	if (page->key == F_KEY_PKGNAME) {
+		free (page->pkgname);
+		page->pkgname = strndup ((const char *) stringVal, stringLen);
+	} else if (page->key == F_KEY_REPO) {
+		free (page->repo);
+		page->repo = strndup ((const char *) stringVal, stringLen);
+	}
+	page->key = F_KEY_NONE;
+	return 1;
+}
+
+static yajl_callbacks flagged_callbacks = {
+	NULL,              /* null */
+	NULL,              /* boolean */
+	flagged_integer,   /* integer */
+	NULL,              /* double */
+	NULL,              /* number */
+	flagged_string,    /* string */
+	flagged_start_map, /* start map */
+	flagged_key,       /* map key */
+	flagged_end_map,   /* end map */
+	NULL,              /* start array */
+	NULL               /* end array */
+};
+
+static bool flagged_feed (const char *data, size_t len, void *ctx)
+{
+	flagged_json_t *page = (flagged_json_t *) ctx;
+	if (yajl_parse (page->hand, (const unsigned char *) data, len) != yajl_status_ok) {
+		page->error = true;
+	}
+	return !page->error;
+}
+
+static void flagged_init (flagged_json_t *page)
+{
+	memset (page, 0, sizeof (flagged_json_t));
+	page->hand = yajl_alloc (&flagged_callbacks, NULL, (void *) page);
+}
+
+/* flagged_end() returns true if the whole page was read */
+static bool flagged_end (flagged_json_t *page, bool fetched)
+{
+	const bool ret = fetched && !page->error &&
+			yajl_complete_parse (page->hand) == yajl_status_ok;
+	yajl_free (page->hand);
+	free (page->pkgname);
+	free (page->repo);
+	return ret;
+}
+
+static char *flagged_url (unsigned int page)
+{
+	char *url = NULL;
+	if (asprintf (&url, "%s%u", ARCH_FLAGGED_URL, page) < 0) {
+		return NULL;
+	}
+	return url;
+}
+
+/* flagged_fetch() gets all flagged packages with the packages search:
+ * the first page gives the number of pages, others are fetched together.
+ * Responses are cached like AUR ones (--aur-cache, --cache-ttl).
+ */
+static bool flagged_fetch (void)
+{
+	CURL *curl = curl_init (CURL_GLOBAL_SSL);
+	if (!curl) {
+		return false;
+	}
+
+	flagged_pkgs = hash_new (1024);
+	flagged_arena = arena_new ();
+
+	flagged_json_t page;
+	flagged_init (&page);
+	char *url = flagged_url (1);
+	bool ret = flagged_end (&page,
+			url && curl_fetch_stream (curl, url, flagged_feed, &page, CACHE_REVALIDATE));
+	free (url);
+	const unsigned int num_pages = page.num_pages;
+
+	alpm_list_t *urls = NULL;
+	for (unsigned int i = 2; ret && i <= num_pages; i++) {
+		urls = alpm_list_add (urls, flagged_url (i));
+	}
+	alpm_list_t *bodies = curl_multi_fetch (curl, urls,
+			(config.aur_jobs) ? config.aur_jobs : FLAGGED_JOBS, CACHE_REVALIDATE, NULL);
+	if (urls && !bodies) {
+		ret = false;
+	}
+	for (const alpm_list_t *b = bodies; ret && b; b = alpm_list_next (b)) {
+		const char *body = b->data;
+		flagged_init (&page);
+		ret = flagged_end (&page, body && flagged_feed (body, strlen (body), &page));
+	}
+
+	FREELIST (bodies);
+	FREELIST (urls);
+	return ret;
+}
+
+/* alpm_pkg_get_outofdate() asks for a few packages one by one,
+ * the whole flagged list is worth it for more */
+static bool alpm_pkg_get_outofdate (alpm_pkg_t *pkg)
+{
+	if (flagged_state == FLAGGED_UNKNOWN && ++flagged_lookups > FLAGGED_SINGLE_MAX) {
+		flagged_state = (flagged_fetch ()) ? FLAGGED_OK : FLAGGED_FAILED;
+	}
+	if (flagged_state != FLAGGED_OK) {
+		return alpm_pkg_fetch_outofdate (pkg);
+	}
+
+	const char *repo = alpm_db_get_name (alpm_pkg_get_db (pkg));
+	const char *name = alpm_pkg_get_name (pkg);
+	if (!repo || !name) {
+		return false;
+	}
+	string_t *key = string_new ();
+	string_cat (key, repo);
+	string_cat (key, "/");
+	string_cat (key, name);
+	const bool flagged = hash_get (flagged_pkgs, string_cstr (key)) != NULL;
+	string_free (key);
+	return flagged;
+}
+
 const char *alpm_pkg_get_str (const void *p, unsigned char c)
 {
 	alpm_pkg_t *pkg = (alpm_pkg_t *) p;
@@ -608,7 +1452,7 @@ const char *alpm_pkg_get_str (const void *p, unsigned char c)
 			break;
 		case 'N':
 			{
-				alpm_list_t *reqs = alpm_pkg_compute_requiredby (pkg);
+				alpm_list_t *reqs = pkg_compute_requiredby (pkg, false);
 				info = concat_str_list (reqs);
 				FREELIST (reqs);
 				free_info = true;
@@ -668,7 +1512,12 @@ const char *alpm_pkg_get_str (const void *p, unsigned char c)
 	return info;
 }
 
-const char *alpm_local_pkg_get_str (const char *pkg_name, unsigned char c)
+alpm_pkg_t *alpm_local_pkg (const char *pkg_name)
+{
+	return (pkg_name) ? alpm_db_get_pkg (alpm_get_localdb (config.handle), pkg_name) : NULL;
+}
+
+const char *alpm_local_pkg_get_str (alpm_pkg_t *pkg, unsigned char c)
 {
 	static char *info = NULL;
 	static bool free_info = false;
@@ -677,11 +1526,6 @@ const char *alpm_local_pkg_get_str (const char *pkg_name, unsigned char c)
 		free_info = false;
 	}
 	info = NULL;
-	if (!pkg_name) {
-		return NULL;
-	}
-
-	alpm_pkg_t *pkg = alpm_db_get_pkg (alpm_get_localdb (config.handle), pkg_name);
 	if (!pkg) {
 		return NULL;
 	}
@@ -731,6 +1575,32 @@ void alpm_cleanup (void)
 {
 	alpm_pkg_get_str (NULL, 0);
 	alpm_local_pkg_get_str (NULL, 0);
+	hash_free (flagged_pkgs);
+	arena_free (flagged_arena);
+	alpm_list_free_inner (depindexes, (alpm_list_fn_free) depindex_free);
+	alpm_list_free (depindexes);
+	depindexes = NULL;
+	alpm_list_free_inner (nameindexes, (alpm_list_fn_free) nameindex_free);
+	alpm_list_free (nameindexes);
+	nameindexes = NULL;
+	hash_free (sync_pkgs);
+	sync_pkgs = NULL;
+	if (root_fd >= 0) {
+		close (root_fd);
+		root_fd = -1;
+	}
+	hash_free (upgrades);
+	upgrades = NULL;
+	hash_free (pkg_states);
+	arena_free (pkg_states_arena);
+	pkg_states = NULL;
+	pkg_states_arena = NULL;
+	hash_free (local_revdeps);
+	arena_free (revdeps_arena);
+	local_revdeps = NULL;
+	revdeps_arena = NULL;
+	flagged_pkgs = NULL;
+	flagged_arena = NULL;
 }
 
 /* vim: set ts=4 sw=4 noet: */
@@ -53,20 +53,25 @@ unsigned int search_pkg_by_type (alpm_db_t *db, alpm_list_t **targets);
 unsigned int search_pkg_by_name (alpm_db_t *db, alpm_list_t **targets);
 unsigned int list_grp (alpm_db_t *db, alpm_list_t *targets);
 unsigned int search_pkg (alpm_db_t *db, alpm_list_t *targets);
+/* search_pkg_dbs() searches dbs at the same time, output is in dbs order */
+unsigned int search_pkg_dbs (const alpm_list_t *dbs, alpm_list_t *targets);
 unsigned int list_db (alpm_db_t *db, alpm_list_t *targets);
 unsigned int alpm_search_local (unsigned short filter, const char *format,
                                 alpm_list_t **res);
 
 off_t get_size_pkg (alpm_pkg_t *pkg);
 
+/* alpm_local_pkg() returns the installed package named pkg_name */
+alpm_pkg_t *alpm_local_pkg (const char *pkg_name);
+
 /*
  * alpm_pkg_get_str() get info for package
- * alpm_local_pkg_get_str() get info for local package
+ * alpm_local_pkg_get_str() get info for local package (from alpm_local_pkg())
  * alpm_grp_get_str() get info for group
  * str returned should not be passed to free
  */
 const char *alpm_pkg_get_str (const void *p, unsigned char c);
-const char *alpm_local_pkg_get_str (const char *pkg_name, unsigned char c);
+const char *alpm_local_pkg_get_str (alpm_pkg_t *pkg, unsigned char c);
 const char *alpm_grp_get_str (const void *p, unsigned char c);
 
 void alpm_cleanup (void);
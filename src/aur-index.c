@@ -0,0 +1,492 @@
+/*
+ *  aur-index.c
+ *
+ *  Copyright (c) 2026 package-query contributors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "aur-index.h"
+#include "util.h"
+
+#define AUR_INDEX_MAGIC   "PQAURIDX"
+#define AUR_INDEX_VERSION 2
+#define AUR_INDEX_NONE    UINT32_MAX
+
+/*
+ * Package fields stored in the index
+ */
+static const size_t str_fields[] =
+{
+	offsetof (aurpkg_t, name),
+	offsetof (aurpkg_t, pkgbase),
+	offsetof (aurpkg_t, version),
+	offsetof (aurpkg_t, desc),
+	offsetof (aurpkg_t, maintainer),
+	offsetof (aurpkg_t, url),
+	offsetof (aurpkg_t, urlpath)
+};
+
+static const size_t list_fields[] =
+{
+	offsetof (aurpkg_t, checkdepends),
+	offsetof (aurpkg_t, conflicts),
+	offsetof (aurpkg_t, depends),
+	offsetof (aurpkg_t, groups),
+	offsetof (aurpkg_t, keywords),
+	offsetof (aurpkg_t, licenses),
+	offsetof (aurpkg_t, makedepends),
+	offsetof (aurpkg_t, optdepends),
+	offsetof (aurpkg_t, provides),
+	offsetof (aurpkg_t, replaces)
+};
+
+#define STR_FIELDS  (sizeof (str_fields) / sizeof (str_fields[0]))
+#define LIST_FIELDS (sizeof (list_fields) / sizeof (list_fields[0]))
+#define PKG_STR(pkg, i)  (*(char **) ((char *) (pkg) + str_fields[i]))
+#define PKG_LIST(pkg, i) (*(alpm_list_t **) ((char *) (pkg) + list_fields[i]))
+
+/* str[] indexes used for lookups */
+#define IDX_NAME       0
+#define IDX_DESC       3
+#define IDX_MAINTAINER 4
+
+/*
+ * On disk format (host byte order):
+ *   header, records sorted by name, string table, list table.
+ * Strings are '\0' terminated, referenced by their offset in the string
+ * table, which is padded with '\0' to keep the list table aligned.
+ * A list is a count followed by as many string offsets.
+ */
+typedef struct _aurindex_header_t
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint64_t strings_size;
+	uint64_t lists_size;
+} aurindex_header_t;
+
+typedef struct _aurindex_record_t
+{
+	uint32_t str[STR_FIELDS];
+	uint32_t list[LIST_FIELDS];
+	uint32_t id;
+	uint32_t pkgbase_id;
+	uint32_t votes;
+	uint32_t outofdate;
+	int64_t firstsubmit;
+	int64_t lastmod;
+	double popularity;
+} aurindex_record_t;
+
+struct _aurindex_t
+{
+	void *map;
+	size_t map_size;
+	uint32_t count;
+	const aurindex_record_t *records;
+	const char *strings;
+	uint64_t strings_size;
+	const uint32_t *lists;
+	uint64_t lists_size;
+};
+
+struct _aurindex_builder_t
+{
+	aurindex_record_t *records;
+	size_t count;
+	size_t records_size;
+	char *strings;
+	size_t strings_used;
+	size_t strings_size;
+	uint32_t *lists;
+	size_t lists_used;
+	size_t lists_size;
+	/* string offsets by hash, to store each string once */
+	uint32_t *table;
+	size_t table_size;
+	size_t table_used;
+	/* set when an offset doesn't fit in uint32_t, the index is not written */
+	bool overflow;
+};
+
+/* Used by qsort () */
+static const char *sort_strings = NULL;
+
+aurindex_builder_t *aur_index_builder_new (void)
+{
+	aurindex_builder_t *builder;
+	MALLOC (builder, sizeof (aurindex_builder_t));
+	builder->table_size = 1024;
+	CALLOC (builder->table, builder->table_size, sizeof (uint32_t));
+	memset (builder->table, 0xff, builder->table_size * sizeof (uint32_t));
+	return builder;
+}
+
+void aur_index_builder_free (aurindex_builder_t *builder)
+{
+	if (!builder) {
+		return;
+	}
+	FREE (builder->records);
+	FREE (builder->strings);
+	FREE (builder->lists);
+	FREE (builder->table);
+	FREE (builder);
+}
+
+static void builder_table_grow (aurindex_builder_t *builder)
+{
+	const size_t old_size = builder->table_size;
+	uint32_t *old_table = builder->table;
+	builder->table_size *= 2;
+	CALLOC (builder->table, builder->table_size, sizeof (uint32_t));
+	memset (builder->table, 0xff, builder->table_size * sizeof (uint32_t));
+	for (size_t i = 0; i < old_size; i++) {
+		if (old_table[i] == AUR_INDEX_NONE) {
+			continue;
+		}
+		size_t k = str_hash (builder->strings + old_table[i]) & (builder->table_size - 1);
+		while (builder->table[k] != AUR_INDEX_NONE) {
+			k = (k + 1) & (builder->table_size - 1);
+		}
+		builder->table[k] = old_table[i];
+	}
+	free (old_table);
+}
+
+/* builder_str() returns offset of str in the string table */
+static uint32_t builder_str (aurindex_builder_t *builder, const char *str)
+{
+	if (!str) {
+		return AUR_INDEX_NONE;
+	}
+
+	size_t k = str_hash (str) & (builder->table_size - 1);
+	while (builder->table[k] != AUR_INDEX_NONE) {
+		if (strcmp (builder->strings + builder->table[k], str) == 0) {
+			return builder->table[k];
+		}
+		k = (k + 1) & (builder->table_size - 1);
+	}
+
+	const size_t len = strlen (str) + 1;
+	if (builder->strings_used + len > AUR_INDEX_NONE) {
+		builder->overflow = true;
+		return AUR_INDEX_NONE;
+	}
+	if (builder->strings_used + len > builder->strings_size) {
+		while (builder->strings_used + len > builder->strings_size) {
+			builder->strings_size = (builder->strings_size) ? builder->strings_size * 2 : 65536;
+		}
+		REALLOC (builder->strings, builder->strings_size);
+	}
+	const uint32_t offset = builder->strings_used;
+	memcpy (builder->strings + offset, str, len);
+	builder->strings_used += len;
+
+	builder->table[k] = offset;
+	if (++builder->table_used * 2 > builder->table_size) {
+		builder_table_grow (builder);
+	}
+	return offset;
+}
+
+static void builder_list_push (aurindex_builder_t *builder, uint32_t value)
+{
+	if (builder->lists_used >= AUR_INDEX_NONE) {
+		builder->overflow = true;
+		return;
+	}
+	if (builder->lists_used == builder->lists_size) {
+		builder->lists_size = (builder->lists_size) ? builder->lists_size * 2 : 4096;
+		REALLOC (builder->lists, builder->lists_size * sizeof (uint32_t));
+	}
+	builder->lists[builder->lists_used++] = value;
+}
+
+static uint32_t builder_list (aurindex_builder_t *builder, const alpm_list_t *list)
+{
+	if (!list) {
+		return AUR_INDEX_NONE;
+	}
+	const uint32_t offset = builder->lists_used;
+	builder_list_push (builder, alpm_list_count (list));
+	for (const alpm_list_t *i = list; i; i = alpm_list_next (i)) {
+		builder_list_push (builder, builder_str (builder, i->data));
+	}
+	return offset;
+}
+
+void aur_index_builder_add (aurindex_builder_t *builder, const aurpkg_t *pkg)
+{
+	if (!builder || !pkg || !pkg->name) {
+		return;
+	}
+	if (builder->count >= AUR_INDEX_NONE) {
+		builder->overflow = true;
+		return;
+	}
+
+	if (builder->count == builder->records_size) {
+		builder->records_size = (builder->records_size) ? builder->records_size * 2 : 1024;
+		REALLOC (builder->records, builder->records_size * sizeof (aurindex_record_t));
+	}
+	aurindex_record_t *rec = builder->records + builder->count++;
+	memset (rec, 0, sizeof (aurindex_record_t));
+	for (size_t i = 0; i < STR_FIELDS; i++) {
+		rec->str[i] = builder_str (builder, PKG_STR (pkg, i));
+	}
+	for (size_t i = 0; i < LIST_FIELDS; i++) {
+		rec->list[i] = builder_list (builder, PKG_LIST (pkg, i));
+	}
+	rec->id = pkg->id;
+	rec->pkgbase_id = pkg->pkgbase_id;
+	rec->votes = pkg->votes;
+	rec->outofdate = pkg->outofdate;
+	rec->firstsubmit = pkg->firstsubmit;
+	rec->lastmod = pkg->lastmod;
+	rec->popularity = pkg->popularity;
+}
+
+static int record_cmp (const void *r1, const void *r2)
+{
+	const aurindex_record_t *rec1 = (const aurindex_record_t *) r1;
+	const aurindex_record_t *rec2 = (const aurindex_record_t *) r2;
+	return strcmp (sort_strings + rec1->str[IDX_NAME], sort_strings + rec2->str[IDX_NAME]);
+}
+
+bool aur_index_builder_write (aurindex_builder_t *builder, const char *path)
+{
+	if (!builder || !path) {
+		return false;
+	}
+	if (builder->overflow) {
+		fprintf (stderr, "AUR dump is too large for the index: %s\n", path);
+		return false;
+	}
+
+	sort_strings = builder->strings;
+	qsort (builder->records, builder->count, sizeof (aurindex_record_t), record_cmp);
+	sort_strings = NULL;
+
+	aurindex_header_t header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, AUR_INDEX_MAGIC, sizeof (header.magic));
+	header.version = AUR_INDEX_VERSION;
+	header.count = builder->count;
+	/* list table must be aligned in the mapped file */
+	static const char padding[sizeof (uint32_t)];
+	const size_t pad = (sizeof (uint32_t) - builder->strings_used % sizeof (uint32_t)) % sizeof (uint32_t);
+	header.strings_size = builder->strings_used + pad;
+	header.lists_size = builder->lists_used;
+
+	char *tmp = NULL;
+	if (asprintf (&tmp, "%s.%d", path, (int) getpid ()) < 0) {
+		return false;
+	}
+	FILE *fp = fopen (tmp, "w");
+	if (!fp) {
+		fprintf (stderr, "Unable to open file: %s\n", tmp);
+		free (tmp);
+		return false;
+	}
+	bool ret = (fwrite (&header, sizeof (header), 1, fp) == 1 &&
+			fwrite (builder->records, sizeof (aurindex_record_t), builder->count, fp) == builder->count &&
+			fwrite (builder->strings, 1, builder->strings_used, fp) == builder->strings_used &&
+			fwrite (padding, 1, pad, fp) == pad &&
+			fwrite (builder->lists, sizeof (uint32_t), builder->lists_used, fp) == builder->lists_used);
+	if (fclose (fp) != 0) {
+		ret = false;
+	}
+	if (ret && rename (tmp, path) != 0) {
+		ret = false;
+	}
+	if (!ret) {
+		fprintf (stderr, "Unable to write index: %s\n", path);
+		unlink (tmp);
+	}
+	free (tmp);
+	return ret;
+}
+
+aurindex_t *aur_index_open (const char *path)
+{
+	const int fd = open (path, O_RDONLY);
+	if (fd < 0) {
+		fprintf (stderr, "Unable to open file: %s\n", path);
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (aurindex_header_t)) {
+		fprintf (stderr, "Invalid AUR index: %s\n", path);
+		close (fd);
+		return NULL;
+	}
+	void *map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED) {
+		perror ("mmap");
+		return NULL;
+	}
+
+	/* each size is bounded by the file size first, so the sum can't overflow */
+	const aurindex_header_t *header = (const aurindex_header_t *) map;
+	const uint64_t avail = (uint64_t) st.st_size - sizeof (aurindex_header_t);
+	const bool sizes_ok = header->count <= avail / sizeof (aurindex_record_t) &&
+			header->strings_size <= avail &&
+			header->strings_size % sizeof (uint32_t) == 0 &&
+			header->lists_size <= avail / sizeof (uint32_t);
+	if (memcmp (header->magic, AUR_INDEX_MAGIC, sizeof (header->magic)) != 0 ||
+			header->version != AUR_INDEX_VERSION || !sizes_ok ||
+			sizeof (aurindex_header_t) + (uint64_t) header->count * sizeof (aurindex_record_t) +
+			header->strings_size + header->lists_size * sizeof (uint32_t) != (uint64_t) st.st_size) {
+		fprintf (stderr, "Invalid AUR index: %s\n", path);
+		munmap (map, st.st_size);
+		return NULL;
+	}
+
+	aurindex_t *idx;
+	MALLOC (idx, sizeof (aurindex_t));
+	idx->map = map;
+	idx->map_size = st.st_size;
+	idx->count = header->count;
+	idx->records = (const aurindex_record_t *) ((const char *) map + sizeof (aurindex_header_t));
+	idx->strings = (const char *) (idx->records + idx->count);
+	idx->strings_size = header->strings_size;
+	idx->lists = (const uint32_t *) (idx->strings + idx->strings_size);
+	idx->lists_size = header->lists_size;
+	/* strings must be terminated, so that a bad offset can't read past the map */
+	if (idx->strings_size && idx->strings[idx->strings_size - 1] != '\0') {
+		fprintf (stderr, "Invalid AUR index: %s\n", path);
+		aur_index_close (idx);
+		return NULL;
+	}
+	return idx;
+}
+
+void aur_index_close (aurindex_t *idx)
+{
+	if (!idx) {
+		return;
+	}
+	munmap (idx->map, idx->map_size);
+	FREE (idx);
+}
+
+static const char *index_str (const aurindex_t *idx, uint32_t offset)
+{
+	if (offset == AUR_INDEX_NONE || offset >= idx->strings_size) {
+		return NULL;
+	}
+	return idx->strings + offset;
+}
+
+static alpm_list_t *index_list (const aurindex_t *idx, aurpkg_t *pkg, uint32_t offset)
+{
+	if (offset == AUR_INDEX_NONE || offset >= idx->lists_size) {
+		return NULL;
+	}
+	const uint32_t count = idx->lists[offset];
+	if (count > idx->lists_size - offset - 1) {
+		return NULL;
+	}
+	alpm_list_t *list = NULL;
+	for (uint32_t i = 1; i <= count; i++) {
+		const char *s = index_str (idx, idx->lists[offset + i]);
+		if (s) {
+			list = aur_pkg_list_add (pkg, list, aur_pkg_strdup (pkg, s));
+		}
+	}
+	return list;
+}
+
+size_t aur_index_count (const aurindex_t *idx)
+{
+	return (idx) ? idx->count : 0;
+}
+
+const char *aur_index_name (const aurindex_t *idx, size_t i)
+{
+	return (idx && i < idx->count) ? index_str (idx, idx->records[i].str[IDX_NAME]) : NULL;
+}
+
+const char *aur_index_desc (const aurindex_t *idx, size_t i)
+{
+	return (idx && i < idx->count) ? index_str (idx, idx->records[i].str[IDX_DESC]) : NULL;
+}
+
+const char *aur_index_maintainer (const aurindex_t *idx, size_t i)
+{
+	return (idx && i < idx->count) ? index_str (idx, idx->records[i].str[IDX_MAINTAINER]) : NULL;
+}
+
+aurpkg_t *aur_index_pkg (const aurindex_t *idx, size_t i)
+{
+	if (!idx || i >= idx->count) {
+		return NULL;
+	}
+
+	const aurindex_record_t *rec = idx->records + i;
+	aurpkg_t *pkg = aur_pkg_new ();
+	for (size_t k = 0; k < STR_FIELDS; k++) {
+		PKG_STR (pkg, k) = aur_pkg_strdup (pkg, index_str (idx, rec->str[k]));
+	}
+	for (size_t k = 0; k < LIST_FIELDS; k++) {
+		PKG_LIST (pkg, k) = index_list (idx, pkg, rec->list[k]);
+	}
+	pkg->id = rec->id;
+	pkg->pkgbase_id = rec->pkgbase_id;
+	pkg->votes = rec->votes;
+	pkg->outofdate = rec->outofdate;
+	pkg->firstsubmit = rec->firstsubmit;
+	pkg->lastmod = rec->lastmod;
+	pkg->popularity = rec->popularity;
+	return pkg;
+}
+
+aurpkg_t *aur_index_find (const aurindex_t *idx, const char *name)
+{
+	if (!idx || !name) {
+		return NULL;
+	}
+
+	size_t low = 0, high = idx->count;
+	while (low < high) {
+		const size_t mid = low + (high - low) / 2;
+		const char *mid_name = aur_index_name (idx, mid);
+		const int cmp = strcmp ((mid_name) ? mid_name : "", name);
+		if (cmp == 0) {
+			return aur_index_pkg (idx, mid);
+		} else if (cmp < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return NULL;
+}
+
+/* vim: set ts=4 sw=4 noet: */
@@ -0,0 +1,60 @@
+/*
+ *  aur-index.h
+ *
+ *  Copyright (c) 2026 package-query contributors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PQ_AUR_INDEX_H
+#define PQ_AUR_INDEX_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "aur.h"
+
+/*
+ * Offline AUR index
+ *
+ * Built from the AUR metadata dump (packages-meta-ext-v1.json),
+ * packages are sorted by name and strings are shared.
+ * The file is mapped read only, so lookups don't need any parsing.
+ */
+typedef struct _aurindex_t aurindex_t;
+typedef struct _aurindex_builder_t aurindex_builder_t;
+
+aurindex_builder_t *aur_index_builder_new (void);
+void aur_index_builder_free (aurindex_builder_t *builder);
+void aur_index_builder_add (aurindex_builder_t *builder, const aurpkg_t *pkg);
+/* aur_index_builder_write() replaces path atomically */
+bool aur_index_builder_write (aurindex_builder_t *builder, const char *path);
+
+/* aur_index_open() returns NULL if path is not a valid index */
+aurindex_t *aur_index_open (const char *path);
+void aur_index_close (aurindex_t *idx);
+
+size_t aur_index_count (const aurindex_t *idx);
+const char *aur_index_name (const aurindex_t *idx, size_t i);
+const char *aur_index_desc (const aurindex_t *idx, size_t i);
+const char *aur_index_maintainer (const aurindex_t *idx, size_t i);
+
+/*
+ * aur_index_pkg() and aur_index_find() return a new package,
+ * use aur_pkg_free() to free it
+ */
+aurpkg_t *aur_index_pkg (const aurindex_t *idx, size_t i);
+aurpkg_t *aur_index_find (const aurindex_t *idx, const char *name);
+
+#endif
+
+/* vim: set ts=4 sw=4 noet: */
@@ -19,11 +19,13 @@
 #include <string.h>
 #include <errno.h>
 #include <locale.h>
+#include <pthread.h>
 
 #include <yajl/yajl_parse.h>
 #include <yajl/yajl_gen.h>
 
 #include "aur.h"
+#include "aur-index.h"
 #include "alpm-query.h"
 #include "util.h"
 
@@ -38,6 +40,7 @@
 #define AUR_RPC_INFO     "&type=info"
 #define AUR_RPC_INFO_ARG "&arg[]="
 #define AUR_PKGBUILD_URL "/cgit/aur.git/plain/PKGBUILD?h="
+#define AUR_PKGBUILD_JOBS 8
 
 /*
  * AUR repo name
@@ -124,6 +127,12 @@ static const char *aur_key_types_names[] =
  * JSON parse packages
  */
 #define AUR_ID_LEN 20
+
+/* Called for each package as soon as it's parsed,
+ * sink takes ownership of pkg.
+ */
+typedef void (*aur_sink_fn)(aurpkg_t *pkg, void *data);
+
 typedef struct _jsonpkg_t
 {
 	alpm_list_t *pkgs;
@@ -132,14 +141,46 @@ typedef struct _jsonpkg_t
 	bool error;
 	char *error_msg;
 	int level;
+	int pkg_level;
+	size_t count;
+	yajl_handle hand;
+	bool parse_error;
+	aur_sink_fn sink;
+	void *sink_data;
 } jsonpkg_t;
 
+/* AUR search state, shared by every package of a search */
+typedef struct _aursearch_t
+{
+	const matcher_t *matcher;
+	unsigned int found;
+	unsigned int received;
+} aursearch_t;
+
+/* Offline index (--aur-index), opened on first request */
+static aurindex_t *aur_index = NULL;
+
+/* AUR responses fetched by aur_prefetch(), bodies are in urls order */
+typedef struct _aurprefetch_t
+{
+	pthread_t thread;
+	CURL *curl;
+	aurrequest_t type;
+	alpm_list_t *urls;
+	alpm_list_t *bodies;
+	bool joined;
+} aurprefetch_t;
+
+static aurprefetch_t *aur_prefetched = NULL;
 
 
-static aurpkg_t *aur_pkg_new (void)
+
+aurpkg_t *aur_pkg_new (void)
 {
-	aurpkg_t *pkg = NULL;
-	MALLOC (pkg, sizeof (aurpkg_t));
+	/* package and its data share one arena */
+	arena_t *arena = arena_new ();
+	aurpkg_t *pkg = arena_alloc (arena, sizeof (aurpkg_t));
+	pkg->arena = arena;
 	return pkg;
 }
 
@@ -149,26 +190,26 @@ void aur_pkg_free (aurpkg_t *pkg)
 		return;
 	}
 
-	FREE (pkg->desc);
-	FREE (pkg->maintainer);
-	FREE (pkg->name);
-	FREE (pkg->pkgbase);
-	FREE (pkg->url);
-	FREE (pkg->urlpath);
-	FREE (pkg->version);
+	arena_free (pkg->arena);
+}
+
+char *aur_pkg_strdup (aurpkg_t *pkg, const char *s)
+{
+	return (s) ? arena_strndup (pkg->arena, s, strlen (s)) : NULL;
+}
 
-	FREELIST (pkg->checkdepends);
-	FREELIST (pkg->conflicts);
-	FREELIST (pkg->depends);
-	FREELIST (pkg->groups);
-	FREELIST (pkg->keywords);
-	FREELIST (pkg->licenses);
-	FREELIST (pkg->makedepends);
-	FREELIST (pkg->optdepends);
-	FREELIST (pkg->provides);
-	FREELIST (pkg->replaces);
+alpm_list_t *aur_pkg_list_add (aurpkg_t *pkg, alpm_list_t *list, char *data)
+{
+	return arena_list_add (pkg->arena, list, data);
+}
 
-	FREE (pkg);
+static alpm_list_t *aur_pkg_list_dup (aurpkg_t *pkg, const alpm_list_t *list)
+{
+	alpm_list_t *ret = NULL;
+	for (const alpm_list_t *i = list; i; i = alpm_list_next (i)) {
+		ret = aur_pkg_list_add (pkg, ret, aur_pkg_strdup (pkg, i->data));
+	}
+	return ret;
 }
 
 aurpkg_t *aur_pkg_dup (const aurpkg_t *pkg)
@@ -179,8 +220,6 @@ aurpkg_t *aur_pkg_dup (const aurpkg_t *pkg)
 
 	aurpkg_t *pkg_ret = aur_pkg_new ();
 
-	// Only copy the values provided by the AUR search request
-	// (all array values are not provided)
 	pkg_ret->firstsubmit = pkg->firstsubmit;
 	pkg_ret->id = pkg->id;
 	pkg_ret->lastmod = pkg->lastmod;
@@ -189,13 +228,24 @@ aurpkg_t *aur_pkg_dup (const aurpkg_t *pkg)
 	pkg_ret->popularity = pkg->popularity;
 	pkg_ret->votes = pkg->votes;
 
-	pkg_ret->desc = STRDUP (pkg->desc);
-	pkg_ret->maintainer = STRDUP (pkg->maintainer);
-	pkg_ret->name = STRDUP (pkg->name);
-	pkg_ret->pkgbase = STRDUP (pkg->pkgbase);
-	pkg_ret->url = STRDUP (pkg->url);
-	pkg_ret->urlpath = STRDUP (pkg->urlpath);
-	pkg_ret->version = STRDUP (pkg->version);
+	pkg_ret->desc = aur_pkg_strdup (pkg_ret, pkg->desc);
+	pkg_ret->maintainer = aur_pkg_strdup (pkg_ret, pkg->maintainer);
+	pkg_ret->name = aur_pkg_strdup (pkg_ret, pkg->name);
+	pkg_ret->pkgbase = aur_pkg_strdup (pkg_ret, pkg->pkgbase);
+	pkg_ret->url = aur_pkg_strdup (pkg_ret, pkg->url);
+	pkg_ret->urlpath = aur_pkg_strdup (pkg_ret, pkg->urlpath);
+	pkg_ret->version = aur_pkg_strdup (pkg_ret, pkg->version);
+
+	pkg_ret->checkdepends = aur_pkg_list_dup (pkg_ret, pkg->checkdepends);
+	pkg_ret->conflicts = aur_pkg_list_dup (pkg_ret, pkg->conflicts);
+	pkg_ret->depends = aur_pkg_list_dup (pkg_ret, pkg->depends);
+	pkg_ret->groups = aur_pkg_list_dup (pkg_ret, pkg->groups);
+	pkg_ret->keywords = aur_pkg_list_dup (pkg_ret, pkg->keywords);
+	pkg_ret->licenses = aur_pkg_list_dup (pkg_ret, pkg->licenses);
+	pkg_ret->makedepends = aur_pkg_list_dup (pkg_ret, pkg->makedepends);
+	pkg_ret->optdepends = aur_pkg_list_dup (pkg_ret, pkg->optdepends);
+	pkg_ret->provides = aur_pkg_list_dup (pkg_ret, pkg->provides);
+	pkg_ret->replaces = aur_pkg_list_dup (pkg_ret, pkg->replaces);
 
 	return pkg_ret;
 }
@@ -350,7 +400,7 @@ static int json_start_map (void *ctx)
 	}
 
 	pkg_json->level++;
-	if (pkg_json->level > 1) {
+	if (pkg_json->level >= pkg_json->pkg_level) {
 		aur_pkg_free (pkg_json->pkg);
 		pkg_json->pkg = aur_pkg_new ();
 	}
@@ -367,9 +417,14 @@ static int json_end_map (void *ctx)
 	}
 
 	pkg_json->level--;
-	if (pkg_json->level == 1 && pkg_json->pkg) {
-		alpm_list_fn_cmp fn_cmp = (config.sort == S_VOTE) ? aur_pkg_votes_cmp : aur_pkg_cmp;
-		pkg_json->pkgs = alpm_list_add_sorted (pkg_json->pkgs, pkg_json->pkg, fn_cmp);
+	if (pkg_json->level == pkg_json->pkg_level - 1 && pkg_json->pkg) {
+		if (pkg_json->sink) {
+			pkg_json->sink (pkg_json->pkg, pkg_json->sink_data);
+		} else {
+			/* sorted once parse is complete, see aur_json_end() */
+			pkg_json->pkgs = alpm_list_add (pkg_json->pkgs, pkg_json->pkg);
+			pkg_json->count++;
+		}
 		pkg_json->pkg = NULL;
 	}
 	return 1;
@@ -403,8 +458,8 @@ static int json_integer (void *ctx, long long val)
 		return 1;
 	}
 
-	// package info in level 2
-	if (pkg_json->level < 2) {
+	// package info in level 2 (level 1 in metadata dump)
+	if (pkg_json->level < pkg_json->pkg_level) {
 		return 1;
 	}
 
@@ -442,8 +497,8 @@ static int json_double (void *ctx, double val)
 		return 1;
 	}
 
-	// package info in level 2
-	if (pkg_json->level < 2) {
+	// package info in level 2 (level 1 in metadata dump)
+	if (pkg_json->level < pkg_json->pkg_level) {
 		return 1;
 	}
 
@@ -466,8 +521,8 @@ static int json_string (void *ctx, const unsigned char *stringVal, size_t string
 		return 1;
 	}
 
-	// package info in level 2
-	if (pkg_json->level < 2) {
+	// package info in level 2 (level 1 in metadata dump)
+	if (pkg_json->level < pkg_json->pkg_level) {
 		if (pkg_json->current_key == AUR_JSON_TYPE_KEY &&
 				strncmp ((const char *) stringVal, AUR_TYPE_ERROR, stringLen) == 0) {
 			pkg_json->error = true;
@@ -483,69 +538,36 @@ static int json_string (void *ctx, const unsigned char *stringVal, size_t string
 		return 1;
 	}
 
-	char *s = strndup ((const char *) stringVal, stringLen);
+	aurpkg_t *pkg = pkg_json->pkg;
+	char **field = NULL;
+	alpm_list_t **list = NULL;
 	switch (pkg_json->current_key) {
-		case AUR_DESCRIPTION:
-			free (pkg_json->pkg->desc);
-			pkg_json->pkg->desc = s;
-			break;
-		case AUR_MAINTAINER:
-			free (pkg_json->pkg->maintainer);
-			pkg_json->pkg->maintainer = s;
-			break;
-		case AUR_NAME:
-			free (pkg_json->pkg->name);
-			pkg_json->pkg->name = s;
-			break;
-		case AUR_PKGBASE:
-			free (pkg_json->pkg->pkgbase);
-			pkg_json->pkg->pkgbase = s;
-			break;
-		case AUR_URL:
-			free (pkg_json->pkg->url);
-			pkg_json->pkg->url = s;
-			break;
-		case AUR_URLPATH:
-			free (pkg_json->pkg->urlpath);
-			pkg_json->pkg->urlpath = s;
-			break;
-		case AUR_VERSION:
-			free (pkg_json->pkg->version);
-			pkg_json->pkg->version = s;
-			break;
-		case AUR_CHECKDEPENDS:
-			pkg_json->pkg->checkdepends = alpm_list_add (pkg_json->pkg->checkdepends, s);
-			break;
-		case AUR_CONFLICTS:
-			pkg_json->pkg->conflicts = alpm_list_add (pkg_json->pkg->conflicts, s);
-			break;
-		case AUR_DEPENDS:
-			pkg_json->pkg->depends = alpm_list_add (pkg_json->pkg->depends, s);
-			break;
-		case AUR_GROUPS:
-			pkg_json->pkg->groups = alpm_list_add (pkg_json->pkg->groups, s);
-			break;
-		case AUR_KEYWORDS:
-			pkg_json->pkg->keywords = alpm_list_add (pkg_json->pkg->keywords, s);
-			break;
-		case AUR_LICENSES:
-			pkg_json->pkg->licenses = alpm_list_add (pkg_json->pkg->licenses, s);
-			break;
-		case AUR_MAKEDEPENDS:
-			pkg_json->pkg->makedepends = alpm_list_add (pkg_json->pkg->makedepends, s);
-			break;
-		case AUR_OPTDEPENDS:
-			pkg_json->pkg->optdepends = alpm_list_add (pkg_json->pkg->optdepends, s);
-			break;
-		case AUR_PROVIDES:
-			pkg_json->pkg->provides = alpm_list_add (pkg_json->pkg->provides, s);
-			break;
-		case AUR_REPLACES:
-			pkg_json->pkg->replaces = alpm_list_add (pkg_json->pkg->replaces, s);
-			break;
-		default:
-			free (s);
-			break;
+		case AUR_DESCRIPTION: field = &(pkg->desc); break;
+		case AUR_MAINTAINER:  field = &(pkg->maintainer); break;
+		case AUR_NAME:        field = &(pkg->name); break;
+		case AUR_PKGBASE:     field = &(pkg->pkgbase); break;
+		case AUR_URL:         field = &(pkg->url); break;
+		case AUR_URLPATH:     field = &(pkg->urlpath); break;
+		case AUR_VERSION:     field = &(pkg->version); break;
+		case AUR_CHECKDEPENDS: list = &(pkg->checkdepends); break;
+		case AUR_CONFLICTS:    list = &(pkg->conflicts); break;
+		case AUR_DEPENDS:      list = &(pkg->depends); break;
+		case AUR_GROUPS:       list = &(pkg->groups); break;
+		case AUR_KEYWORDS:     list = &(pkg->keywords); break;
+		case AUR_LICENSES:     list = &(pkg->licenses); break;
+		case AUR_MAKEDEPENDS:  list = &(pkg->makedepends); break;
+		case AUR_OPTDEPENDS:   list = &(pkg->optdepends); break;
+		case AUR_PROVIDES:     list = &(pkg->provides); break;
+		case AUR_REPLACES:     list = &(pkg->replaces); break;
+		default: return 1;
+	}
+
+	/* strings live in the package arena, freed with the package */
+	char *s = arena_strndup (pkg->arena, (const char *) stringVal, stringLen);
+	if (field) {
+		*field = s;
+	} else {
+		*list = aur_pkg_list_add (pkg, *list, s);
 	}
 
 	return 1;
@@ -565,47 +587,139 @@ static yajl_callbacks callbacks = {
     NULL,
 };
 
-static alpm_list_t *aur_json_parse (char *s, char *error)
+static alpm_list_t *aur_pkgs_sort (alpm_list_t *pkgs, size_t count)
 {
-	if (!s) {
-		return NULL;
+	if (count < 2) {
+		return pkgs;
 	}
+	/* reversed first, so equal packages keep the order
+	 * alpm_list_add_sorted() used to give them */
+	alpm_list_t *reversed = alpm_list_reverse (pkgs);
+	alpm_list_free (pkgs);
+	alpm_list_fn_cmp fn_cmp = (config.sort == S_VOTE) ? aur_pkg_votes_cmp : aur_pkg_cmp;
+	return alpm_list_msort (reversed, count, fn_cmp);
+}
 
+static void aur_json_init (jsonpkg_t *pkg_json, aur_sink_fn sink, void *sink_data)
+{
 	// this setlocale() hack is a workaround for the yajl issue:
 	// https://github.com/lloyd/yajl/issues/79
 	setlocale (LC_ALL, "C");
 
-	const size_t len = strlen (s);
-	jsonpkg_t pkg_json = {NULL, NULL, 0, false, NULL, 0};
-	yajl_handle hand = yajl_alloc (&callbacks, NULL, (void *) &pkg_json);
-	yajl_status stat = yajl_parse (hand, (const unsigned char *) s, len);
+	memset (pkg_json, 0, sizeof (jsonpkg_t));
+	pkg_json->pkg_level = 2;
+	pkg_json->sink = sink;
+	pkg_json->sink_data = sink_data;
+	pkg_json->hand = yajl_alloc (&callbacks, NULL, (void *) pkg_json);
+}
+
+/* aur_json_feed() parses a chunk of the response as soon as it's received */
+static bool aur_json_feed (const char *data, size_t len, void *ctx)
+{
+	jsonpkg_t *pkg_json = (jsonpkg_t *) ctx;
+
+	if (pkg_json->parse_error) {
+		return false;
+	}
 
-	if (stat == yajl_status_ok) {
-		stat = yajl_complete_parse (hand);
+	if (yajl_parse (pkg_json->hand, (const unsigned char *) data, len) != yajl_status_ok) {
+		unsigned char *str = yajl_get_error (pkg_json->hand, 1, (const unsigned char *) data, len);
+		fprintf(stderr, "%s\n", (const char *) str);
+		yajl_free_error (pkg_json->hand, str);
+		pkg_json->parse_error = true;
 	}
-	if (stat != yajl_status_ok) {
-		unsigned char *str = yajl_get_error (hand, 1, (const unsigned char *) s, len);
+
+	return !pkg_json->parse_error;
+}
+
+/* aur_json_end() returns packages which were not given to a sink.
+ * fetched is false if the transfer failed.
+ */
+static alpm_list_t *aur_json_end (jsonpkg_t *pkg_json, bool fetched, char *error)
+{
+	if (fetched && !pkg_json->parse_error &&
+			yajl_complete_parse (pkg_json->hand) != yajl_status_ok) {
+		unsigned char *str = yajl_get_error (pkg_json->hand, 0, NULL, 0);
 		fprintf(stderr, "%s\n", (const char *) str);
-		yajl_free_error (hand, str);
-		alpm_list_free_inner (pkg_json.pkgs, (alpm_list_fn_free) aur_pkg_free);
-		alpm_list_free (pkg_json.pkgs);
-		pkg_json.pkgs = NULL;
+		yajl_free_error (pkg_json->hand, str);
+		pkg_json->parse_error = true;
+	}
+	if (!fetched || pkg_json->parse_error) {
+		alpm_list_free_inner (pkg_json->pkgs, (alpm_list_fn_free) aur_pkg_free);
+		alpm_list_free (pkg_json->pkgs);
+		pkg_json->pkgs = NULL;
+	} else {
+		pkg_json->pkgs = aur_pkgs_sort (pkg_json->pkgs, pkg_json->count);
 	}
 
-	yajl_free (hand);
-	if (pkg_json.error) {
+	yajl_free (pkg_json->hand);
+	pkg_json->hand = NULL;
+	/* package left open by an incomplete response */
+	aur_pkg_free (pkg_json->pkg);
+	pkg_json->pkg = NULL;
+
+	if (pkg_json->error) {
 		if (error) {
-			strcpy (error, pkg_json.error_msg);
+			strcpy (error, pkg_json->error_msg);
 		} else {
-			fprintf(stderr, "AUR error : %s\n", pkg_json.error_msg);
+			fprintf(stderr, "AUR error : %s\n", pkg_json->error_msg);
 		}
-		FREE (pkg_json.error_msg);
+		FREE (pkg_json->error_msg);
 	}
 
 	setlocale (LC_ALL, "");
+
+	return pkg_json->pkgs;
+}
+
+alpm_list_t *aur_json_parse (char *s, char *error)
+{
+	if (!s) {
+		return NULL;
+	}
+
+	jsonpkg_t pkg_json;
+	aur_json_init (&pkg_json, NULL, NULL);
+	aur_json_feed (s, strlen (s), &pkg_json);
 	free (s);
 
-	return pkg_json.pkgs;
+	return aur_json_end (&pkg_json, true, error);
+}
+
+/* aur_fetch_parse() parses the response while it's being received.
+ * Returns false on transfer error, parsed (may be NULL) is false
+ * if the response was not fully parsed.
+ */
+static bool aur_fetch_parse (CURL *curl, const char *url, aur_sink_fn sink, void *sink_data,
+                             char *error, alpm_list_t **pkgs, bool *parsed)
+{
+	jsonpkg_t pkg_json;
+	aur_json_init (&pkg_json, sink, sink_data);
+	const bool fetched = curl_fetch_stream (curl, url, aur_json_feed, &pkg_json, CACHE_REVALIDATE);
+	*pkgs = aur_json_end (&pkg_json, fetched, error);
+	if (parsed) {
+		*parsed = fetched && !pkg_json.parse_error;
+	}
+	return fetched;
+}
+
+/* aur_body_parse() is aur_fetch_parse() on a prefetched body, NULL if
+ * its transfer failed. body is freed.
+ */
+static bool aur_body_parse (char *body, aur_sink_fn sink, void *sink_data,
+                            char *error, alpm_list_t **pkgs, bool *parsed)
+{
+	jsonpkg_t pkg_json;
+	aur_json_init (&pkg_json, sink, sink_data);
+	if (body) {
+		aur_json_feed (body, strlen (body), &pkg_json);
+	}
+	*pkgs = aur_json_end (&pkg_json, body != NULL, error);
+	if (parsed) {
+		*parsed = body && !pkg_json.parse_error;
+	}
+	free (body);
+	return body != NULL;
 }
 
 static string_t *aur_prepare_url (const char *aur_rpc_type)
@@ -618,86 +732,284 @@ static string_t *aur_prepare_url (const char *aur_rpc_type)
 	return url;
 }
 
+/* aur_search_url() returns the search url for arg, NULL arg is for
+ * orphans with --maintainer */
+static char *aur_search_url (const char *arg, CURL *curl)
+{
+	char *encoded_arg = (arg) ? curl_easy_escape (curl, arg, 0) : NULL;
+	string_t *url = aur_prepare_url (AUR_RPC_SEARCH);
+	string_cat (url, encoded_arg);
+	curl_free (encoded_arg);
+	if (config.name_only) {
+		string_cat (url, AUR_RPC_BYNAME);
+	} else if (config.aur_maintainer) {
+		string_cat (url, AUR_RPC_BYMAINT);
+	}
+	return string_free2 (url);
+}
+
+/* aur_prefetch_join() waits for the prefetch of type, if any */
+static aurprefetch_t *aur_prefetch_join (aurrequest_t type)
+{
+	aurprefetch_t *prefetch = aur_prefetched;
+	if (!prefetch || prefetch->type != type) {
+		return NULL;
+	}
+	if (!prefetch->joined) {
+		pthread_join (prefetch->thread, NULL);
+		prefetch->joined = true;
+	}
+	return prefetch;
+}
+
+/* aur_prefetch_take() gives the prefetched body of url.
+ * Returns false if url was not prefetched.
+ */
+static bool aur_prefetch_take (aurrequest_t type, const char *url, char **body)
+{
+	aurprefetch_t *prefetch = aur_prefetch_join (type);
+	if (!prefetch || !prefetch->bodies) {
+		return false;
+	}
+	alpm_list_t *b = prefetch->bodies;
+	for (alpm_list_t *u = prefetch->urls; u && b; u = alpm_list_next (u), b = alpm_list_next (b)) {
+		if (u->data && strcmp (u->data, url) == 0) {
+			*body = b->data;
+			b->data = NULL;
+			FREE (u->data);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool aur_prefetch_pending (void)
+{
+	const aurprefetch_t *prefetch = aur_prefetched;
+	return (prefetch && !prefetch->joined);
+}
+
+/* aur_prefetch_free() joins the thread, not to be called from a signal handler */
+static void aur_prefetch_free (void)
+{
+	aurprefetch_t *prefetch = aur_prefetched;
+	if (!prefetch) {
+		return;
+	}
+	if (!prefetch->joined) {
+		pthread_join (prefetch->thread, NULL);
+	}
+	curl_easy_cleanup (prefetch->curl);
+	FREELIST (prefetch->urls);
+	FREELIST (prefetch->bodies);
+	free (prefetch);
+	aur_prefetched = NULL;
+}
+
+/* aur_search_add() takes ownership of pkg */
+static void aur_search_add (aurpkg_t *pkg, void *data)
+{
+	aursearch_t *search = (aursearch_t *) data;
+	search->received++;
+
+	if (!config.aur_maintainer && !matcher_match (search->matcher,
+			aur_pkg_get_string_value (pkg, AUR_NAME),
+			aur_pkg_get_string_value (pkg, AUR_DESCRIPTION))) {
+		aur_pkg_free (pkg);
+		return;
+	}
+
+	search->found++;
+	print_or_add_result (pkg, R_AUR_PKG);
+}
+
+/* aur_index_search() is aur_request_search() on the offline index,
+ * packages are already sorted by name */
+static unsigned int aur_index_search (const aurindex_t *idx, const alpm_list_t *targets)
+{
+	alpm_list_t *pkgs = NULL;
+	unsigned int pkgs_found = 0;
+	const char *arg = (targets) ? targets->data : NULL;
+	if (!arg && !config.aur_maintainer) {
+		return 0;
+	}
+
+	matcher_t *matcher = matcher_new (targets, false);
+	for (size_t i = 0; i < aur_index_count (idx); i++) {
+		const char *pkgname = aur_index_name (idx, i);
+		if (!pkgname) {
+			continue;
+		}
+		if (config.aur_maintainer) {
+			/* no target: orphaned packages */
+			const char *maintainer = aur_index_maintainer (idx, i);
+			if ((arg) ? (!maintainer || strcmp (maintainer, arg) != 0) : maintainer != NULL) {
+				continue;
+			}
+		} else if ((config.name_only && strcasestr (pkgname, arg) == NULL) ||
+				!matcher_match (matcher, pkgname, aur_index_desc (idx, i))) {
+			continue;
+		}
+
+		pkgs = alpm_list_add (pkgs, aur_index_pkg (idx, i));
+		pkgs_found++;
+	}
+	matcher_free (matcher);
+
+	aur_prefetch_arch (pkgs);
+	for (const alpm_list_t *p = pkgs; p; p = alpm_list_next (p)) {
+		print_or_add_result (p->data, R_AUR_PKG);
+	}
+	alpm_list_free (pkgs);
+
+	return pkgs_found;
+}
+
 static unsigned int aur_request_search (alpm_list_t **targets, CURL *curl)
 {
 	alpm_list_t *pkgs = NULL;
 	char error[256] = {0};
-
-	for (const alpm_list_t *t = *targets; !pkgs; t = alpm_list_next (*targets)) {
-		char *encoded_arg = NULL;
-		if (t) {
-			encoded_arg = curl_easy_escape (curl, t->data, 0);
-		} else if (!config.aur_maintainer) {
+	matcher_t *matcher = matcher_new (*targets, false);
+	aursearch_t search = {matcher, 0, 0};
+	/* show_results() sorts results anyway, so they can be added
+	 * while the response is parsed, then put in the order
+	 * aur_pkgs_sort() gives for equal sort keys */
+	const aur_sink_fn sink = (config.sort) ? aur_search_add : NULL;
+	const size_t mark = results_mark ();
+
+	for (const alpm_list_t *t = *targets; !pkgs && !search.received; t = alpm_list_next (t)) {
+		if (!t && (!config.aur_maintainer || *targets)) {
 			break;
 		}
 
-		string_t *url = aur_prepare_url (AUR_RPC_SEARCH);
-		string_cat (url, encoded_arg);
-		curl_free (encoded_arg);
-		if (config.name_only) {
-			string_cat (url, AUR_RPC_BYNAME);
-		} else if (config.aur_maintainer) {
-			string_cat (url, AUR_RPC_BYMAINT);
+		char *url = aur_search_url ((t) ? t->data : NULL, curl);
+		char *body = NULL;
+		bool parsed = false;
+		const bool fetched = (aur_prefetch_take (AUR_SEARCH, url, &body))
+				? aur_body_parse (body, sink, &search, error, &pkgs, &parsed)
+				: aur_fetch_parse (curl, url, sink, &search, error, &pkgs, &parsed);
+		free (url);
+		if (!parsed) {
+			/* a broken response gives no result, like before streaming:
+			 * drop packages already sunk and try the next target.
+			 * Earlier targets added nothing, mark is still valid. */
+			results_rollback (mark);
+			search.found = search.received = 0;
 		}
-
-		char *curl_res = curl_fetch (curl, string_cstr (url));
-		string_free (url);
-		if (!curl_res) {
+		if (!fetched) {
 			break; // stop on any curl error
 		}
-
-		pkgs = aur_json_parse (curl_res, error);
 	}
 
-	if (!pkgs && error[0] != '\0') {
+	if (!pkgs && !search.received && error[0] != '\0') {
 		fprintf(stderr, "AUR error : %s\n", error);
 	}
 
+	if (!sink && format_has_field ('a')) {
+		alpm_list_t *matches = NULL;
+		for (const alpm_list_t *p = pkgs; p; p = alpm_list_next (p)) {
+			const aurpkg_t *pkg = p->data;
+			if (config.aur_maintainer || matcher_match (matcher, pkg->name, pkg->desc)) {
+				matches = alpm_list_add (matches, p->data);
+			}
+		}
+		aur_prefetch_arch (matches);
+		alpm_list_free (matches);
+	}
+
+	/* packages are owned by results now */
+	for (const alpm_list_t *p = pkgs; p; p = alpm_list_next (p)) {
+		aur_search_add (p->data, &search);
+	}
+	alpm_list_free (pkgs);
+	matcher_free (matcher);
+	if (sink) {
+		results_sort_since (mark, (config.sort == S_VOTE) ? aur_pkg_votes_cmp : aur_pkg_cmp);
+	}
+
+	return search.found;
+}
+
+/* aur_info_add() prints packages matching targets and frees pkgs */
+static unsigned int aur_info_add (alpm_list_t *pkgs, const alpm_list_t *real_targets, target_arg_t *ta)
+{
 	unsigned int pkgs_found = 0;
+	aur_prefetch_arch (pkgs);
 	for (const alpm_list_t *p = pkgs; p; p = alpm_list_next (p)) {
-		bool match = true;
 		const aurpkg_t *pkg = p->data;
-
-		if (!config.aur_maintainer) {
-			const char *pkgname = aur_pkg_get_string_value (pkg, AUR_NAME);
-			const char *pkgdesc = aur_pkg_get_string_value (pkg, AUR_DESCRIPTION);
-			for (const alpm_list_t *t = *targets; t; t = alpm_list_next (t)) {
-				if (strcasestr (pkgname, t->data) == NULL &&
-						(!pkgdesc || strcasestr (pkgdesc, t->data) == NULL)) {
-					match = false;
-					break;
-				}
+		const char *pkgname = aur_pkg_get_string_value (pkg, AUR_NAME);
+		const char *pkgver = aur_pkg_get_string_value (pkg, AUR_VERSION);
+		const target_t *one_target = alpm_list_find (real_targets,
+				pkgname, (alpm_list_fn_cmp) target_name_cmp);
+		if (one_target && target_check_version (one_target, pkgver)) {
+			if (config.pkgbase && strcmp (pkgname, aur_pkg_get_string_value (pkg, AUR_PKGBASE)) != 0) {
+				continue;
 			}
-		}
-
-		if (match) {
 			pkgs_found++;
-			print_or_add_result (pkg, R_AUR_PKG);
+			/* one_target->orig is not duplicated,
+			 * 'ta' will use it until target_arg_close() call.
+			 */
+			if (target_arg_add (ta, one_target->orig, (void *) pkgname)) {
+				print_package (one_target->orig, (const void *) pkg, aur_get_str);
+			}
 		}
 	}
 
 	alpm_list_free_inner (pkgs, (alpm_list_fn_free) aur_pkg_free);
 	alpm_list_free (pkgs);
-
 	return pkgs_found;
 }
 
-static unsigned int aur_request_info (alpm_list_t **targets, CURL *curl)
+static int aur_pkg_name_cmp (const void *p1, const void *name)
 {
-	alpm_list_t *real_targets = NULL;
-	for (const alpm_list_t *t = *targets; t; t = alpm_list_next (t)) {
-		target_t *one_target = target_parse (t->data);
-		if (one_target->db && strcmp (one_target->db, AUR_REPO) != 0) {
-			target_free (one_target);
-		} else {
-			real_targets = alpm_list_add (real_targets, one_target);
-		}
-	}
+	const char *pkgname = aur_pkg_get_name ((const aurpkg_t *) p1);
+	return (pkgname) ? strcmp (pkgname, (const char *) name) : -1;
+}
 
+/* Returns a new package named name, or NULL */
+typedef aurpkg_t *(*aur_find_fn)(const char *name, void *data);
+
+static aurpkg_t *aur_index_lookup (const char *name, void *data)
+{
+	return aur_index_find ((const aurindex_t *) data, name);
+}
+
+static aurpkg_t *aur_prefetch_lookup (const char *name, void *data)
+{
+	return aur_pkg_dup (hash_get ((const hash_t *) data, name));
+}
+
+/* aur_lookup_info() looks targets up in AUR_MAX_ARG chunks,
+ * so that output order is the same as with RPC */
+static unsigned int aur_lookup_info (const alpm_list_t *real_targets, target_arg_t *ta,
+                                     aur_find_fn find, void *data)
+{
 	unsigned int pkgs_found = 0;
-	target_arg_t *ta = target_arg_init ((ta_dup_fn) strdup, (alpm_list_fn_cmp) strcmp, free);
 	const alpm_list_t *t = real_targets;
+	while (t) {
+		alpm_list_t *pkgs = NULL;
+		size_t count = 0;
+		for (int args_left = AUR_MAX_ARG; t && args_left--; t = alpm_list_next (t)) {
+			const target_t *one_target = t->data;
+			if (alpm_list_find (pkgs, one_target->name, aur_pkg_name_cmp)) {
+				continue;
+			}
+			aurpkg_t *pkg = find (one_target->name, data);
+			if (pkg) {
+				pkgs = alpm_list_add (pkgs, pkg);
+				count++;
+			}
+		}
+		pkgs_found += aur_info_add (aur_pkgs_sort (pkgs, count), real_targets, ta);
+	}
+	return pkgs_found;
+}
 
+/* aur_info_urls() splits targets in AUR_MAX_ARG chunks, one url each */
+static alpm_list_t *aur_info_urls (const alpm_list_t *real_targets, CURL *curl)
+{
+	alpm_list_t *urls = NULL;
+	const alpm_list_t *t = real_targets;
 	while (t) {
 		bool fetch_waiting = false;
 		string_t *url = aur_prepare_url (AUR_RPC_INFO);
@@ -720,31 +1032,103 @@ static unsigned int aur_request_info (alpm_list_t **targets, CURL *curl)
 			break;
 		}
 
-		alpm_list_t *pkgs = aur_json_parse (curl_fetch (curl, string_cstr (url)), NULL);
-		string_free (url);
+		urls = alpm_list_add (urls, string_free2 (url));
+	}
+	return urls;
+}
 
-		for (const alpm_list_t *p = pkgs; p; p = alpm_list_next (p)) {
-			const aurpkg_t *pkg = p->data;
-			const char *pkgname = aur_pkg_get_string_value (pkg, AUR_NAME);
-			const char *pkgver = aur_pkg_get_string_value (pkg, AUR_VERSION);
-			const target_t *one_target = alpm_list_find (real_targets,
-					pkgname, (alpm_list_fn_cmp) target_name_cmp);
-			if (one_target && target_check_version (one_target, pkgver)) {
-				if (config.pkgbase && strcmp (pkgname, aur_pkg_get_string_value (pkg, AUR_PKGBASE)) != 0) {
-					continue;
-				}
-				pkgs_found++;
-				/* one_target->orig is not duplicated,
-				 * 'ta' will use it until target_arg_close() call.
-				 */
-				if (target_arg_add (ta, one_target->orig, (void *) pkgname)) {
-					print_package (one_target->orig, (const void *) pkg, aur_get_str);
-				}
-			}
+static unsigned int aur_rpc_info (const alpm_list_t *real_targets, target_arg_t *ta, CURL *curl)
+{
+	alpm_list_t *urls = aur_info_urls (real_targets, curl);
+
+	/* with --aur-jobs, all chunks are fetched at the same time */
+	alpm_list_t *responses = NULL;
+	if (config.aur_jobs > 1 && alpm_list_count (urls) > 1) {
+		responses = curl_multi_fetch (curl, urls, config.aur_jobs, CACHE_REVALIDATE, NULL);
+	}
+
+	unsigned int pkgs_found = 0;
+	const alpm_list_t *r = responses;
+	for (const alpm_list_t *u = urls; u; u = alpm_list_next (u)) {
+		alpm_list_t *pkgs = NULL;
+		if (responses) {
+			pkgs = aur_json_parse (r->data, NULL);
+			r = alpm_list_next (r);
+		} else {
+			aur_fetch_parse (curl, u->data, NULL, NULL, NULL, &pkgs, NULL);
+		}
+		pkgs_found += aur_info_add (pkgs, real_targets, ta);
+	}
+
+	/* bodies are freed by aur_json_parse() */
+	alpm_list_free (responses);
+	FREELIST (urls);
+
+	return pkgs_found;
+}
+
+/* aur_prefetch_info() answers from responses prefetched for all targets,
+ * some of them may have been found in databases since.
+ * Returns false if there are none or a transfer failed.
+ */
+static bool aur_prefetch_info (const alpm_list_t *real_targets, target_arg_t *ta,
+                               unsigned int *pkgs_found)
+{
+	aurprefetch_t *prefetch = aur_prefetch_join (AUR_INFO);
+	if (!prefetch || !prefetch->bodies) {
+		return false;
+	}
+	for (const alpm_list_t *b = prefetch->bodies; b; b = alpm_list_next (b)) {
+		if (!b->data) {
+			return false;
+		}
+	}
+
+	alpm_list_t *pkgs = NULL;
+	hash_t *names = hash_new (alpm_list_count (real_targets));
+	for (alpm_list_t *b = prefetch->bodies; b; b = alpm_list_next (b)) {
+		alpm_list_t *chunk = aur_json_parse (b->data, NULL);
+		b->data = NULL;
+		for (const alpm_list_t *p = chunk; p; p = alpm_list_next (p)) {
+			hash_add (names, aur_pkg_get_name (p->data), p->data);
+		}
+		pkgs = alpm_list_join (pkgs, chunk);
+	}
+
+	*pkgs_found = aur_lookup_info (real_targets, ta, aur_prefetch_lookup, names);
+
+	hash_free (names);
+	alpm_list_free_inner (pkgs, (alpm_list_fn_free) aur_pkg_free);
+	alpm_list_free (pkgs);
+	return true;
+}
+
+/* aur_info_targets() returns targets which may be in AUR */
+static alpm_list_t *aur_info_targets (const alpm_list_t *targets)
+{
+	alpm_list_t *real_targets = NULL;
+	for (const alpm_list_t *t = targets; t; t = alpm_list_next (t)) {
+		target_t *one_target = target_parse (t->data);
+		if (one_target->db && strcmp (one_target->db, AUR_REPO) != 0) {
+			target_free (one_target);
+		} else {
+			real_targets = alpm_list_add (real_targets, one_target);
 		}
+	}
+	return real_targets;
+}
+
+/* aur_request_info() answers from idx if not NULL, else from RPC with curl */
+static unsigned int aur_request_info (alpm_list_t **targets, const aurindex_t *idx, CURL *curl)
+{
+	alpm_list_t *real_targets = aur_info_targets (*targets);
 
-		alpm_list_free_inner (pkgs, (alpm_list_fn_free) aur_pkg_free);
-		alpm_list_free (pkgs);
+	target_arg_t *ta = target_arg_init ((ta_dup_fn) strdup, (alpm_list_fn_cmp) strcmp, free);
+	unsigned int pkgs_found = 0;
+	if (idx) {
+		pkgs_found = aur_lookup_info (real_targets, ta, aur_index_lookup, (void *) idx);
+	} else if (!aur_prefetch_info (real_targets, ta, &pkgs_found)) {
+		pkgs_found = aur_rpc_info (real_targets, ta, curl);
 	}
 
 	/* target_arg_close() must be called before freeing real_targets */
@@ -755,8 +1139,110 @@ static unsigned int aur_request_info (alpm_list_t **targets, CURL *curl)
 	return pkgs_found;
 }
 
+static void *aur_prefetch_run (void *data)
+{
+	aurprefetch_t *prefetch = (aurprefetch_t *) data;
+	prefetch->bodies = curl_multi_fetch (prefetch->curl, prefetch->urls,
+			(config.aur_jobs > 1) ? config.aur_jobs : 1, CACHE_REVALIDATE, NULL);
+	return NULL;
+}
+
+void aur_prefetch (const alpm_list_t *targets, aurrequest_t type)
+{
+	if (config.aur_index || aur_prefetched) {
+		return;
+	}
+
+	/* curl_init() keeps an SSL handle, so it's not reinitialized
+	 * while the transfers run */
+	CURL *curl = curl_init (CURL_GLOBAL_SSL);
+	if (!curl) {
+		return;
+	}
+
+	alpm_list_t *urls = NULL;
+	if (type == AUR_SEARCH) {
+		if (targets || config.aur_maintainer) {
+			urls = alpm_list_add (urls, aur_search_url ((targets) ? targets->data : NULL, curl));
+		}
+	} else {
+		alpm_list_t *real_targets = aur_info_targets (targets);
+		urls = aur_info_urls (real_targets, curl);
+		alpm_list_free_inner (real_targets, (alpm_list_fn_free) target_free);
+		alpm_list_free (real_targets);
+	}
+	if (!urls) {
+		return;
+	}
+
+	aurprefetch_t *prefetch;
+	CALLOC (prefetch, 1, sizeof (aurprefetch_t));
+	prefetch->type = type;
+	prefetch->urls = urls;
+	/* the thread has its own handle */
+	prefetch->curl = curl_easy_duphandle (curl);
+	if (!prefetch->curl ||
+			pthread_create (&prefetch->thread, NULL, aur_prefetch_run, prefetch) != 0) {
+		if (prefetch->curl) {
+			curl_easy_cleanup (prefetch->curl);
+		}
+		FREELIST (urls);
+		free (prefetch);
+		return;
+	}
+	aur_prefetched = prefetch;
+}
+
+static void aur_import_add (aurpkg_t *pkg, void *data)
+{
+	aur_index_builder_add ((aurindex_builder_t *) data, pkg);
+	aur_pkg_free (pkg);
+}
+
+bool aur_import (const char *dump, const char *index)
+{
+	FILE *fp = (strcmp (dump, "-") == 0) ? stdin : fopen (dump, "r");
+	if (!fp) {
+		fprintf (stderr, "Unable to open file: %s\n", dump);
+		return false;
+	}
+
+	aurindex_builder_t *builder = aur_index_builder_new ();
+	jsonpkg_t pkg_json;
+	aur_json_init (&pkg_json, aur_import_add, builder);
+	/* the dump is an array of packages */
+	pkg_json.pkg_level = 1;
+
+	char buf[65536];
+	size_t len;
+	while ((len = fread (buf, 1, sizeof (buf), fp)) > 0) {
+		if (!aur_json_feed (buf, len, &pkg_json)) {
+			break;
+		}
+	}
+	const bool read_ok = !ferror (fp);
+	if (fp != stdin) {
+		fclose (fp);
+	}
+
+	aur_json_end (&pkg_json, read_ok, NULL);
+	const bool ret = read_ok && !pkg_json.parse_error &&
+			aur_index_builder_write (builder, index);
+	aur_index_builder_free (builder);
+	return ret;
+}
+
 unsigned int aur_request (alpm_list_t **targets, aurrequest_t type)
 {
+	if (config.aur_index) {
+		if (!aur_index && (aur_index = aur_index_open (config.aur_index)) == NULL) {
+			return 0;
+		}
+		return (type == AUR_SEARCH)
+				? aur_index_search (aur_index, *targets)
+				: aur_request_info (targets, aur_index, NULL);
+	}
+
 	CURL *curl = (strncmp (config.aur_url, "https", strlen ("https")) == 0) ?
 			curl_init (CURL_GLOBAL_SSL) : curl_init (CURL_GLOBAL_NOTHING);
 	if (!curl) {
@@ -765,7 +1251,8 @@ unsigned int aur_request (alpm_list_t **targets, aurrequest_t type)
 
 	const unsigned int aur_pkgs_found = (type == AUR_SEARCH)
 			? aur_request_search (targets, curl)
-			: aur_request_info (targets, curl);
+			: aur_request_info (targets, NULL, curl);
+	aur_prefetch_free ();
 
 	return aur_pkgs_found;
 }
@@ -795,36 +1282,107 @@ static alpm_list_t *read_pkgbuild_field (const char *pkgbuild, const char *field
 	return field_list;
 }
 
-static char *aur_get_arch (const aurpkg_t *pkg)
+/* PKGBUILD arch of each pkgbase, only known after %a was asked for.
+ * Kept out of aurpkg_t so that %a works on const packages.
+ */
+typedef struct _aurarch_t
 {
-	if (!pkg) {
-		return NULL;
+	char *arch;	/* NULL if the PKGBUILD has none */
+} aurarch_t;
+
+static hash_t *aur_archs = NULL;
+static arena_t *aur_archs_arena = NULL;
+
+static void aur_arch_add (const char *pkgbase, const char *pkgbuild)
+{
+	if (!aur_archs) {
+		aur_archs = hash_new (64);
+		aur_archs_arena = arena_new ();
+	}
+	aurarch_t *entry = arena_alloc (aur_archs_arena, sizeof (aurarch_t));
+	if (pkgbuild) {
+		alpm_list_t *arch_list = read_pkgbuild_field (pkgbuild, "arch=('");
+		char *arch = concat_str_list (arch_list);
+		if (arch) {
+			entry->arch = arena_strndup (aur_archs_arena, arch, strlen (arch));
+		}
+		free (arch);
+		FREELIST (arch_list);
 	}
+	hash_add (aur_archs,
+			arena_strndup (aur_archs_arena, pkgbase, strlen (pkgbase)), entry);
+}
 
-	CURL *curl = curl_init (CURL_GLOBAL_SSL);
-	if (!curl) {
-		return NULL;
+/* aur_fetch_arch() downloads PKGBUILDs of pkgs concurrently,
+ * once per pkgbase.
+ * A cached PKGBUILD is never revalidated while LastModified is the same.
+ */
+static void aur_fetch_arch (const alpm_list_t *pkgs)
+{
+	alpm_list_t *bases = NULL;
+	alpm_list_t *urls = NULL;
+	alpm_list_t *versions = NULL;
+	for (const alpm_list_t *p = pkgs; p; p = alpm_list_next (p)) {
+		const aurpkg_t *pkg = p->data;
+		if (!pkg->pkgbase || hash_get (aur_archs, pkg->pkgbase) ||
+				alpm_list_find_str (bases, pkg->pkgbase)) {
+			continue;
+		}
+		/* https://aur.archlinux.org/cgit/aur.git/plain/PKGBUILD?h=$pkgbase */
+		char *url = NULL;
+		char *version = NULL;
+		if (asprintf (&url, "%s%s%s", config.aur_url, AUR_PKGBUILD_URL, pkg->pkgbase) < 0) {
+			continue;
+		}
+		if (asprintf (&version, "%lld", (long long) pkg->lastmod) < 0) {
+			free (url);
+			continue;
+		}
+		bases = alpm_list_add (bases, pkg->pkgbase);
+		urls = alpm_list_add (urls, url);
+		versions = alpm_list_add (versions, version);
 	}
 
-	char *arch = NULL;
-	char *url = NULL;
-	const char *pkgbase = aur_pkg_get_string_value (pkg, AUR_PKGBASE);
+	CURL *curl = (urls) ? curl_init (CURL_GLOBAL_SSL) : NULL;
+	alpm_list_t *pkgbuilds = NULL;
+	if (curl) {
+		pkgbuilds = curl_multi_fetch (curl, urls,
+				(config.aur_jobs) ? config.aur_jobs : AUR_PKGBUILD_JOBS, CACHE_KEEP, versions);
+	}
 
-	/* https://aur.archlinux.org/cgit/aur.git/plain/PKGBUILD?h=$pkgbase */
-	int ret = asprintf (&url, "%s%s%s", config.aur_url, AUR_PKGBUILD_URL, pkgbase);
-	if (ret > 0) {
-		char *res = curl_fetch (curl, url);
-		if (res) {
-			alpm_list_t *arch_list = read_pkgbuild_field (res, "arch=('");
-			arch = concat_str_list (arch_list);
-			free (res);
-			FREELIST (arch_list);
-		}
+	const alpm_list_t *b = bases;
+	for (const alpm_list_t *r = pkgbuilds; r && b; r = alpm_list_next (r), b = alpm_list_next (b)) {
+		aur_arch_add (b->data, r->data);
+	}
+
+	FREELIST (pkgbuilds);
+	FREELIST (urls);
+	FREELIST (versions);
+	alpm_list_free (bases);
+}
+
+void aur_prefetch_arch (const alpm_list_t *pkgs)
+{
+	if (pkgs && format_has_field ('a')) {
+		aur_fetch_arch (pkgs);
 	}
+}
 
-	free (url);
+static const char *aur_get_arch (const aurpkg_t *pkg)
+{
+	if (!pkg || !pkg->pkgbase) {
+		return NULL;
+	}
 
-	return arch;
+	const aurarch_t *entry = hash_get (aur_archs, pkg->pkgbase);
+	if (!entry) {
+		/* not prefetched: fetch it alone */
+		alpm_list_t *one = alpm_list_add (NULL, (void *) pkg);
+		aur_fetch_arch (one);
+		alpm_list_free (one);
+		entry = hash_get (aur_archs, pkg->pkgbase);
+	}
+	return (entry) ? entry->arch : NULL;
 }
 
 const char *aur_get_str (const void *p, unsigned char c)
@@ -839,8 +1397,7 @@ const char *aur_get_str (const void *p, unsigned char c)
 	info = NULL;
 	switch (c) {
 		case 'a':
-			info = aur_get_arch (pkg);
-			free_info = true;
+			info = (char *) aur_get_arch (pkg);
 			break;
 		case 'b':
 			info = aur_pkg_get_string_value (pkg, AUR_PKGBASE);
@@ -975,6 +1532,13 @@ const char *aur_get_str (const void *p, unsigned char c)
 void aur_cleanup (void)
 {
 	aur_get_str (NULL, 0);
+	aur_index_close (aur_index);
+	aur_index = NULL;
+	aur_prefetch_free ();
+	hash_free (aur_archs);
+	aur_archs = NULL;
+	arena_free (aur_archs_arena);
+	aur_archs_arena = NULL;
 }
 
 /* vim: set ts=4 sw=4 noet: */
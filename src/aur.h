@@ -55,6 +55,9 @@ typedef struct _aurpkg_t
 	time_t lastmod;
 
 	double popularity;
+
+	/* strings and lists above are allocated in arena */
+	struct _arena_t *arena;
 } aurpkg_t;
 
 /*
@@ -65,8 +68,12 @@ typedef enum {
 	AUR_SEARCH = 2
 } aurrequest_t;
 
+aurpkg_t *aur_pkg_new (void);
 void aur_pkg_free (aurpkg_t *pkg);
 aurpkg_t *aur_pkg_dup (const aurpkg_t *pkg);
+/* aur_pkg_strdup() and aur_pkg_list_add() allocate in pkg arena */
+char *aur_pkg_strdup (aurpkg_t *pkg, const char *s);
+alpm_list_t *aur_pkg_list_add (aurpkg_t *pkg, alpm_list_t *list, char *data);
 
 const char *aur_pkg_get_name (const aurpkg_t *pkg);
 unsigned int aur_pkg_get_votes (const aurpkg_t *pkg);
@@ -78,6 +85,36 @@ double aur_pkg_get_popularity (const aurpkg_t *pkg);
  */
 unsigned int aur_request (alpm_list_t **targets, aurrequest_t type);
 
+/*
+ * aur_prefetch() starts fetching AUR responses for targets in the background,
+ * aur_request() of the same type uses them.
+ * Responses are not parsed until then, so that output keeps its order.
+ */
+void aur_prefetch (const alpm_list_t *targets, aurrequest_t type);
+/* aur_prefetch_pending() returns true if the prefetch thread wasn't joined.
+ * It's safe in a signal handler, which must then leave the thread
+ * to _exit() rather than run aur_cleanup().
+ */
+bool aur_prefetch_pending (void);
+
+/*
+ * aur_json_parse() parses a whole RPC response s, which is freed.
+ * Returns its packages sorted, error gets the AUR error message if not NULL.
+ */
+alpm_list_t *aur_json_parse (char *s, char *error);
+
+/*
+ * aur_import() builds the offline index from the AUR metadata dump
+ * (packages-meta-ext-v1.json, uncompressed), dump "-" reads stdin
+ */
+bool aur_import (const char *dump, const char *index);
+
+/*
+ * aur_prefetch_arch() downloads PKGBUILDs needed by %a for all pkgs
+ * at once, so that aur_get_str() doesn't fetch them one by one
+ */
+void aur_prefetch_arch (const alpm_list_t *pkgs);
+
 /*
  * aur_get_str() get info for package
  * str returned should not be passed to free
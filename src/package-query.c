@@ -57,11 +57,18 @@ static void cleanup (int ret)
 	}
 	FREELIST (targets);
 	FREE (config.arch);
+	FREE (config.aur_import);
+	FREE (config.aur_index);
 	FREE (config.aur_url);
+	FREE (config.cache_dir);
 	FREE (config.configfile);
-	FREE (config.format_out);
+	format_free (config.format_out);
+	config.format_out = NULL;
 	FREE (config.dbpath);
 	FREE (config.rootdir);
+	if (config.stats) {
+		cache_print_stats ();
+	}
 	alpm_cleanup ();
 	aur_cleanup ();
 	color_cleanup ();
@@ -69,6 +76,16 @@ static void cleanup (int ret)
 	exit (ret);
 }
 
+static void cleanup_signal (int signum)
+{
+	/* the prefetch thread may hold malloc or curl locks,
+	 * joining it or freeing memory here could deadlock */
+	if (aur_prefetch_pending ()) {
+		_exit (signum);
+	}
+	cleanup (signum);
+}
+
 static void init_config (const char *myname)
 {
 	memset (&config, 0, sizeof (aq_config));
@@ -76,6 +93,7 @@ static void init_config (const char *myname)
 	config.colors = isatty(1) ? true : false;
 	config.query = OP_Q_ALL;
 	config.aur_url = strdup (AUR_BASE_URL);
+	config.cache_ttl = CACHE_TTL;
 	config.configfile = strndup (CONFFILE, PATH_MAX);
 	strcpy (config.delimiter, " ");
 }
@@ -106,6 +124,12 @@ static void usage (unsigned short _error)
 	fprintf(stderr, "\n\t--rsort <parameter>  sort search results in reverse order");
 	fprintf(stderr, "\n\t--show-size          show package size");
 	fprintf(stderr, "\n\t--insecure           perform insecure ssl connection (curl)");
+	fprintf(stderr, "\n\t--aur-jobs <n>       run up to n AUR info requests at the same time");
+	fprintf(stderr, "\n\t--aur-cache <dir>    cache AUR responses in dir");
+	fprintf(stderr, "\n\t--cache-ttl <sec>    use cached responses without revalidation for sec seconds");
+	fprintf(stderr, "\n\t--stats              show cache statistics on stderr");
+	fprintf(stderr, "\n\t--aur-index <file>   query AUR offline index instead of AUR");
+	fprintf(stderr, "\n\t--aur-import <dump>  build AUR offline index from metadata dump");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "\n\t-A --aur             query AUR database");
 	fprintf(stderr, "\n\t-Q --query           search in local database");
@@ -179,6 +203,9 @@ static unsigned int deal_db (alpm_db_t *db)
 
 static unsigned int deal_sync_dbs (void)
 {
+	if (config.op == OP_SEARCH) {
+		return search_pkg_dbs (alpm_get_syncdbs (config.handle), targets);
+	}
 	unsigned int ret = 0;
 	for (const alpm_list_t *t = alpm_get_syncdbs (config.handle); t; t = alpm_list_next (t)) {
 		ret += deal_db (t->data);
@@ -195,7 +222,7 @@ int main (int argc, char **argv)
 
 	struct sigaction a;
 	init_config (argv[0]);
-	a.sa_handler = cleanup;
+	a.sa_handler = cleanup_signal;
 	sigemptyset (&a.sa_mask);
 	a.sa_flags = 0;
 	sigaction (SIGINT, &a, NULL);
@@ -246,6 +273,12 @@ int main (int argc, char **argv)
 		{"pkgbase",    no_argument,       0, 1016},
 		{"nameonly",   no_argument,       0, 1017},
 		{"maintainer", no_argument,       0, 1018},
+		{"aur-jobs",   required_argument, 0, 1019},
+		{"aur-cache",  required_argument, 0, 1020},
+		{"cache-ttl",  required_argument, 0, 1021},
+		{"stats",      no_argument,       0, 1022},
+		{"aur-index",  required_argument, 0, 1023},
+		{"aur-import", required_argument, 0, 1024},
 		{"version",    no_argument,       0, 'v'},
 
 		{0, 0, 0, 0}
@@ -277,9 +310,13 @@ int main (int argc, char **argv)
 				break;
 			case 'f':
 				config.custom_out = true;
-				free (config.format_out);
-				config.format_out = strndup (optarg, PATH_MAX);
-				format_str (config.format_out);
+				format_free (config.format_out);
+				{
+					char *format = strndup (optarg, PATH_MAX);
+					format_str (format);
+					config.format_out = format_new (format);
+					free (format);
+				}
 				break;
 			case 'g':
 				if (config.op) break;
@@ -424,6 +461,27 @@ int main (int argc, char **argv)
 			case 1018: /* --maintainer */
 				config.aur_maintainer = true;
 				break;
+			case 1019: /* --aur-jobs */
+				config.aur_jobs = strtoul (optarg, NULL, 10);
+				break;
+			case 1020: /* --aur-cache */
+				free (config.cache_dir);
+				config.cache_dir = strndup (optarg, PATH_MAX);
+				break;
+			case 1021: /* --cache-ttl */
+				config.cache_ttl = strtoul (optarg, NULL, 10);
+				break;
+			case 1022: /* --stats */
+				config.stats = true;
+				break;
+			case 1023: /* --aur-index */
+				free (config.aur_index);
+				config.aur_index = strndup (optarg, PATH_MAX);
+				break;
+			case 1024: /* --aur-import */
+				free (config.aur_import);
+				config.aur_import = strndup (optarg, PATH_MAX);
+				break;
 			default: /* '?' */
 				usage (1);
 				break;
@@ -442,6 +500,15 @@ int main (int argc, char **argv)
 		cleanup (0);
 	}
 
+	if (config.aur_import) {
+		/* --aur-import builds the index and exits. */
+		if (!config.aur_index) {
+			fprintf (stderr, "--aur-import needs an index file (--aur-index).\n");
+			cleanup (1);
+		}
+		cleanup (!aur_import (config.aur_import, config.aur_index));
+	}
+
 	if (!config.custom_out) {
 		if (config.colors) {
 			color_init ();
@@ -500,6 +567,14 @@ int main (int argc, char **argv)
 	}
 
 	if (cycle_db || targets) {
+		if (config.aur > 1) {
+			/* AUR is fetched while the databases before it are read */
+			if (config.op == OP_INFO || config.op == OP_INFO_P) {
+				aur_prefetch (targets, AUR_INFO);
+			} else if (config.op == OP_SEARCH) {
+				aur_prefetch (targets, AUR_SEARCH);
+			}
+		}
 		for (i = 1; i <= db_order; i++) {
 			if (config.db_sync == i) {
 				ret += deal_sync_dbs ();
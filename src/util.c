@@ -25,7 +25,12 @@
 #include <regex.h>
 #include <float.h>
 #include <limits.h>
+#include <stdint.h>
 #include <time.h>
+#include <errno.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "alpm-query.h"
@@ -34,16 +39,15 @@
 
 #define FORMAT_LOCAL_PKG "lF134"
 #define INDENT 4
+/* Initial size of string_t, grown by doubling */
+#define STRING_SIZE 64
 
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
-#define MIN3(a, b, c) ((a) < (b) ? ((a) < (c) ? (a) : (c)) : ((b) < (c) ? (b) : (c)))
 
 /* User agent */
 #define PQ_USERAGENT "package-query/" PACKAGE_VERSION
 
-typedef alpm_list_t *(*alpm_list_nav)(const alpm_list_t *);
-
 /* curl init config */
 typedef struct _curl_config_t
 {
@@ -53,259 +57,455 @@ typedef struct _curl_config_t
 
 static curl_config_t curl_config = {NULL, -1};
 
-static alpm_list_t *results = NULL;
+/* HTTP cache */
+#define CACHE_MAGIC "package-query cache 2"
+
+typedef struct _cache_entry_t
+{
+	char *key;
+	char *path;
+	char *body;
+	size_t body_len;
+	char *etag;
+	char *lastmod;
+	char *version;
+	bool fresh;
+	char *new_etag;
+	char *new_lastmod;
+	struct curl_slist *headers;
+} cache_entry_t;
+
+typedef struct _cache_stats_t
+{
+	unsigned int hits;
+	unsigned int revalidated;
+	unsigned int misses;
+} cache_stats_t;
+
+static cache_stats_t cache_stats = {0, 0, 0};
+/* transfers may run on the AUR prefetch thread */
+#define CACHE_STAT(field) __atomic_fetch_add (&cache_stats.field, 1, __ATOMIC_RELAXED)
 
 /* Results */
 typedef struct _results_t
 {
 	void *ele;
+	const char *name;
 	double rel;
+	uint64_t key;   /* sort key of show_results() */
+	size_t order;   /* position when added, to keep sorts stable */
 	pkgtype_t type;
 } results_t;
 
-static results_t *results_new (const void *ele, pkgtype_t type)
+static results_t *results = NULL;
+static size_t results_count = 0;
+static size_t results_size = 0;
+
+static void results_add (void *ele, pkgtype_t type)
 {
-	results_t *r = NULL;
-	MALLOC (r, sizeof (results_t));
-	r->ele = (void *) ((type == R_AUR_PKG) ? aur_pkg_dup ((const aurpkg_t *) ele) : ele);
-	r->rel = DBL_MAX;
+	if (results_count == results_size) {
+		results_size = (results_size) ? 2 * results_size : 64;
+		REALLOC (results, results_size * sizeof (results_t));
+	}
+	results_t *r = results + results_count;
+	r->ele = ele;
 	r->type = type;
-	return r;
+	r->name = (type == R_ALPM_PKG) ? alpm_pkg_get_name ((alpm_pkg_t *) ele)
+	                                : aur_pkg_get_name ((const aurpkg_t *) ele);
+	r->rel = DBL_MAX;
+	r->key = 0;
+	r->order = results_count++;
 }
 
-static void results_free (results_t *r)
+static void results_clear (void)
 {
-	if (r) {
-		if (r->type == R_AUR_PKG) {
-			aur_pkg_free (r->ele);
+	for (size_t i = 0; i < results_count; i++) {
+		if (results[i].type == R_AUR_PKG) {
+			aur_pkg_free (results[i].ele);
 		}
-		free (r);
 	}
+	FREE (results);
+	results_count = results_size = 0;
 }
 
-static const char *results_name (const results_t *r)
+/* Keys compare as unsigned integers, in ascending order */
+#define SIGN_BIT ((uint64_t) 1 << 63)
+
+static uint64_t int_key (long long i)
 {
-	if (!r) {
-		return NULL;
-	}
-	switch (r->type) {
-		case R_ALPM_PKG:
-			return alpm_pkg_get_name ((alpm_pkg_t *) r->ele);
-		case R_AUR_PKG:
-			return aur_pkg_get_name ((const aurpkg_t *) r->ele);
-		default:
-			return NULL;
-	}
+	return (uint64_t) i ^ SIGN_BIT;
 }
 
-static time_t results_installdate (const results_t *r)
+static uint64_t double_key (double d)
 {
-	if (!r || r->type == R_AUR_PKG) {
-		return 0;
+	/* -0.0 and 0.0 compare equal */
+	if (d == 0) {
+		d = 0;
 	}
-	time_t idate = 0;
-	const char *r_name = results_name (r);
-	alpm_pkg_t *pkg = alpm_db_get_pkg (alpm_get_localdb (config.handle), r_name);
-	if (pkg) {
-		idate = alpm_pkg_get_installdate (pkg);
-	}
-	return idate;
+	uint64_t u;
+	memcpy (&u, &d, sizeof (u));
+	return (u & SIGN_BIT) ? ~u : u | SIGN_BIT;
 }
 
-static off_t results_isize (const results_t *r)
+static uint64_t results_key (const results_t *r, stype_t sort)
 {
-	if (!r || r->type == R_AUR_PKG) {
-		return 0;
+	switch (sort) {
+		case S_IDATE:
+			if (r->type == R_ALPM_PKG) {
+				alpm_pkg_t *pkg = alpm_local_pkg (r->name);
+				return int_key ((pkg) ? alpm_pkg_get_installdate (pkg) : 0);
+			}
+			return int_key (0);
+		case S_ISIZE:
+			return int_key ((r->type == R_ALPM_PKG) ? alpm_pkg_get_isize ((alpm_pkg_t *) r->ele) : 0);
+		case S_VOTE:
+			/* most voted first, ALPM packages last */
+			return (r->type == R_AUR_PKG) ? ~((uint64_t) aur_pkg_get_votes ((const aurpkg_t *) r->ele) + 1) : ~(uint64_t) 0;
+		case S_POP:
+			/* most popular first, ALPM packages on top */
+			return ~double_key ((r->type == R_AUR_PKG) ? aur_pkg_get_popularity ((const aurpkg_t *) r->ele) : DBL_MAX);
+		case S_REL:
+			return double_key (r->rel);
+		default:
+			return 0;
 	}
-	return alpm_pkg_get_isize ((alpm_pkg_t *) r->ele);
 }
 
-static unsigned int results_votes (const results_t *r)
+/* results_radix_sort() is a stable sort on keys, 8 bits per pass */
+static void results_radix_sort (results_t *r, size_t n)
 {
-	if (!r || r->type != R_AUR_PKG) {
-		return UINT_MAX; // put ALPM packages on top
+	results_t *tmp;
+	CALLOC (tmp, n, sizeof (results_t));
+	results_t *src = r, *dst = tmp;
+	for (unsigned int shift = 0; shift < 64; shift += 8) {
+		size_t count[256] = {0};
+		for (size_t i = 0; i < n; i++) {
+			count[(src[i].key >> shift) & 0xff]++;
+		}
+		if (count[(src[0].key >> shift) & 0xff] == n) {
+			/* same byte everywhere */
+			continue;
+		}
+		size_t pos = 0;
+		for (size_t b = 0; b < 256; b++) {
+			const size_t c = count[b];
+			count[b] = pos;
+			pos += c;
+		}
+		for (size_t i = 0; i < n; i++) {
+			dst[count[(src[i].key >> shift) & 0xff]++] = src[i];
+		}
+		results_t *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != r) {
+		memcpy (r, src, n * sizeof (results_t));
 	}
-	return aur_pkg_get_votes ((const aurpkg_t *) r->ele);
+	free (tmp);
 }
 
-static double results_popularity (const results_t *r)
+static int results_cmp (const void *p1, const void *p2)
 {
-	if (!r || r->type != R_AUR_PKG) {
-		return DBL_MAX; // put ALPM packages on top
+	const results_t *r1 = p1, *r2 = p2;
+	const int ret = (r1->name && r2->name) ? strcmp (r1->name, r2->name) : 0;
+	if (ret) {
+		return ret;
 	}
-	return aur_pkg_get_popularity ((const aurpkg_t *) r->ele);
+	return (r1->order > r2->order) - (r1->order < r2->order);
 }
 
-static double results_relevance (const results_t *r)
+/* Thread pool size of threads_run() */
+#define THREADS_MAX 8
+
+typedef struct _threads_job_t
 {
-	return r ? r->rel : DBL_MAX;
+	threads_fn fn;
+	void *data;
+	size_t start;
+	size_t count;
+} threads_job_t;
+
+static void *threads_job_run (void *data)
+{
+	const threads_job_t *job = (const threads_job_t *) data;
+	job->fn (job->data, job->start, job->count);
+	return NULL;
 }
 
-static int results_cmp (const void *r1, const void *r2)
+void threads_run (size_t count, size_t per_thread, threads_fn fn, void *data)
 {
-	const char *r1name = results_name ((const results_t *) r1);
-	const char *r2name = results_name ((const results_t *) r2);
-	if (!r1name || !r2name) {
-		return 0;
+	size_t nthreads = (per_thread) ? count / per_thread : 1;
+	const long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && nthreads > (size_t) cpus) {
+		nthreads = cpus;
+	}
+	if (nthreads > THREADS_MAX) {
+		nthreads = THREADS_MAX;
+	} else if (nthreads < 1) {
+		nthreads = 1;
+	}
+
+	threads_job_t jobs[THREADS_MAX];
+	pthread_t threads[THREADS_MAX];
+	bool started[THREADS_MAX] = {false};
+	const size_t chunk = (count + nthreads - 1) / nthreads;
+	for (size_t t = 0; t < nthreads; t++) {
+		jobs[t].fn = fn;
+		jobs[t].data = data;
+		jobs[t].start = t * chunk;
+		jobs[t].count = (jobs[t].start >= count) ? 0 :
+				(count - jobs[t].start < chunk) ? count - jobs[t].start : chunk;
+		/* first chunk is done by this thread */
+		if (t > 0) {
+			started[t] = (pthread_create (threads + t, NULL, threads_job_run, jobs + t) == 0);
+		}
+	}
+	for (size_t t = 0; t < nthreads; t++) {
+		if (t == 0 || !started[t]) {
+			threads_job_run (jobs + t);
+		} else {
+			pthread_join (threads[t], NULL);
+		}
 	}
-	return strcmp (r1name, r2name);
 }
 
-static int results_installdate_cmp (const void *r1, const void *r2)
+/*
+ * Relevance: edit distance and longest common subsequence between
+ * targets and results names, computed 64 characters of the target at a time
+ * (Myers/Hyyrö and Allison-Dix bit-vector algorithms).
+ * Result sets of 2048 entries or more are split between threads.
+ */
+#define RELEVANCE_THREAD_RESULTS 1024
+
+/* Target with, for each byte, the bit mask of its positions */
+typedef struct _bitpattern_t
 {
-	const time_t idate1 = results_installdate ((const results_t *) r1);
-	const time_t idate2 = results_installdate ((const results_t *) r2);
-	if (idate1 > idate2) return 1;
-	if (idate2 > idate1) return -1;
-	return 0;
-}
+	size_t len;
+	size_t words;
+	uint64_t *peq;  /* words masks per byte value */
+} bitpattern_t;
 
-static int results_isize_cmp (const void *r1, const void *r2)
+static void bitpattern_init (bitpattern_t *p, const char *s)
 {
-	const off_t isize1 = results_isize ((const results_t *) r1);
-	const off_t isize2 = results_isize ((const results_t *) r2);
-	if (isize1 > isize2) return 1;
-	if (isize2 > isize1) return -1;
-	return 0;
+	p->len = strlen (s);
+	p->words = (p->len + 63) / 64;
+	CALLOC (p->peq, (UCHAR_MAX + 1) * p->words + 1, sizeof (uint64_t));
+	for (size_t i = 0; i < p->len; i++) {
+		p->peq[(unsigned char) s[i] * p->words + i / 64] |= (uint64_t) 1 << (i % 64);
+	}
 }
 
-static int results_votes_cmp (const void *r1, const void *r2)
+/* levenshtein_distance() uses pv, mv as scratch of p->words */
+static size_t levenshtein_distance (const bitpattern_t *p, const char *s, uint64_t *pv, uint64_t *mv)
 {
-	return (results_votes ((const results_t *) r2) - results_votes ((const results_t *) r1));
+	if (!p->len) {
+		return strlen (s);
+	}
+	const uint64_t high = (uint64_t) 1 << 63;
+	const uint64_t last = (uint64_t) 1 << ((p->len - 1) % 64);
+	for (size_t b = 0; b < p->words; b++) {
+		pv[b] = ~(uint64_t) 0;
+		mv[b] = 0;
+	}
+	size_t score = p->len;
+	for (const unsigned char *c = (const unsigned char *) s; *c; c++) {
+		const uint64_t *peq = p->peq + *c * p->words;
+		/* horizontal delta entering the block, +1 on the first row */
+		int hin = 1;
+		for (size_t b = 0; b < p->words; b++) {
+			const uint64_t out = (b + 1 < p->words) ? high : last;
+			uint64_t eq = peq[b];
+			const uint64_t xv = eq | mv[b];
+			if (hin < 0) {
+				eq |= 1;
+			}
+			const uint64_t xh = (((eq & pv[b]) + pv[b]) ^ pv[b]) | eq;
+			uint64_t ph = mv[b] | ~(xh | pv[b]);
+			uint64_t mh = pv[b] & xh;
+			const int hout = (ph & out) ? 1 : (mh & out) ? -1 : 0;
+			ph <<= 1;
+			mh <<= 1;
+			if (hin < 0) {
+				mh |= 1;
+			} else if (hin > 0) {
+				ph |= 1;
+			}
+			pv[b] = mh | ~(xv | ph);
+			mv[b] = ph & xv;
+			hin = hout;
+		}
+		score += hin;
+	}
+	return score;
 }
 
-static int results_popularity_cmp (const void *r1, const void *r2)
+/* longest_common_subseq() uses v as scratch of p->words */
+static size_t longest_common_subseq (const bitpattern_t *p, const char *s, uint64_t *v)
 {
-	const double pop1 = results_popularity ((const results_t *) r1);
-	const double pop2 = results_popularity ((const results_t *) r2);
-	if (pop1 > pop2) return -1;
-	if (pop2 > pop1) return 1;
-	return 0;
+	if (!p->len) {
+		return 0;
+	}
+	for (size_t b = 0; b < p->words; b++) {
+		v[b] = ~(uint64_t) 0;
+	}
+	for (const unsigned char *c = (const unsigned char *) s; *c; c++) {
+		const uint64_t *peq = p->peq + *c * p->words;
+		uint64_t carry = 0;
+		for (size_t b = 0; b < p->words; b++) {
+			const uint64_t u = v[b] & peq[b];
+			const uint64_t sum = v[b] + u + carry;
+			carry = (sum < v[b] || (carry && sum == v[b]));
+			v[b] = sum | (v[b] & ~u);
+		}
+	}
+	/* each 0 bit in the target's length is a common character */
+	size_t lcs = 0;
+	for (size_t b = 0; b < p->words; b++) {
+		uint64_t bits = ~v[b];
+		if (b + 1 == p->words && p->len % 64) {
+			bits &= ((uint64_t) 1 << (p->len % 64)) - 1;
+		}
+		lcs += __builtin_popcountll (bits);
+	}
+	return lcs;
 }
 
-static int results_relevance_cmp (const void *r1, const void *r2)
+typedef struct _relevance_job_t
 {
-	const double rel1 = results_relevance ((const results_t *) r1);
-	const double rel2 = results_relevance ((const results_t *) r2);
-	if (rel1 > rel2) return 1;
-	if (rel2 > rel1) return -1;
-	return 0;
+	const bitpattern_t *patterns;
+	size_t npatterns;
+	size_t words;  /* largest pattern */
+} relevance_job_t;
+
+static void relevance_compute (void *data, size_t start, size_t count)
+{
+	const relevance_job_t *job = (const relevance_job_t *) data;
+	uint64_t *scratch;
+	CALLOC (scratch, 2 * job->words + 1, sizeof (uint64_t));
+	for (size_t t = 0; t < job->npatterns; t++) {
+		const bitpattern_t *p = job->patterns + t;
+		for (size_t i = start; i < start + count; i++) {
+			results_t *res = results + i;
+			const double lev_dst = (double) levenshtein_distance (p, res->name, scratch, scratch + p->words);
+			// calc LCS only if searching by both name and description
+			const size_t lcs = !config.name_only ? longest_common_subseq (p, res->name, scratch) : 0;
+			const double rel = lcs ? lev_dst / lcs : lev_dst;
+			res->rel = MIN (res->rel, rel);
+		}
+	}
+	free (scratch);
 }
 
-// https://en.wikibooks.org/wiki/Algorithm_Implementation/Strings/Levenshtein_distance#C
-static size_t levenshtein_distance (const char *s1, const char *s2)
+void calculate_results_relevance (const alpm_list_t *targets)
 {
-	const size_t s1len = strlen (s1);
-	const size_t s2len = strlen (s2);
-	if (s1len == 0) {
-		return s2len;
+	if (!results_count || !targets) {
+		return;
 	}
-	if (s2len == 0) {
-		return s1len;
+
+	bitpattern_t *patterns;
+	CALLOC (patterns, alpm_list_count (targets), sizeof (bitpattern_t));
+	size_t npatterns = 0, words = 0;
+	for (const alpm_list_t *t = targets; t; t = alpm_list_next (t)) {
+		bitpattern_init (patterns + npatterns, t->data);
+		words = MAX (words, patterns[npatterns].words);
+		npatterns++;
 	}
 
-	size_t column[s1len + 1];
-	for (size_t x = 1; x <= s1len; x++) {
-		column[x] = x;
+	relevance_job_t job = {patterns, npatterns, words};
+	threads_run (results_count, RELEVANCE_THREAD_RESULTS, relevance_compute, &job);
+
+	for (size_t t = 0; t < npatterns; t++) {
+		free (patterns[t].peq);
 	}
-	for (size_t x = 1; x <= s2len; x++) {
-		column[0] = x;
-		size_t lastdiag = x - 1;
-		for (size_t y = 1; y <= s1len; y++) {
-			const size_t olddiag = column[y];
-			column[y] = MIN3 (column[y] + 1, column[y-1] + 1, lastdiag + (s1[y-1] == s2[x-1] ? 0 : 1));
-			lastdiag = olddiag;
+	free (patterns);
+}
+
+void print_or_add_result (void *pkg, pkgtype_t type)
+{
+	if (config.sort == 0) {
+		print_package ("", pkg, (type == R_ALPM_PKG) ? alpm_pkg_get_str : aur_get_str);
+		if (type == R_AUR_PKG) {
+			aur_pkg_free (pkg);
 		}
+		return;
 	}
 
-	return column[s1len];
+	results_add (pkg, type);
 }
 
-// http://www.geeksforgeeks.org/dynamic-programming-set-4-longest-common-subsequence/
-static size_t longest_common_subseq (const char *s1, const char *s2)
+size_t results_mark (void)
 {
-	const size_t s1len = strlen (s1);
-	const size_t s2len = strlen (s2);
-	size_t L[s1len + 1][s2len + 1];
+	return results_count;
+}
 
-	/* Following steps build L[m+1][n+1] in bottom up fashion. Note
-	that L[i][j] contains length of LCS of s1[0..i-1] and s2[0..j-1] */
-	for (size_t i = 0; i <= s1len; i++) {
-		for (size_t j = 0; j <= s2len; j++) {
-			if (i == 0 || j == 0) {
-				L[i][j] = 0;
-			} else if (s1[i-1] == s2[j-1]) {
-				L[i][j] = L[i-1][j-1] + 1;
-			} else {
-				L[i][j] = MAX (L[i-1][j], L[i][j-1]);
-			}
+void results_rollback (size_t mark)
+{
+	for (size_t i = mark; i < results_count; i++) {
+		if (results[i].type == R_AUR_PKG) {
+			aur_pkg_free (results[i].ele);
 		}
 	}
-
-	/* L[m][n] contains length of LCS for s1[0..n-1] and s2[0..m-1] */
-	return L[s1len][s2len];
+	if (mark < results_count) {
+		results_count = mark;
+	}
 }
 
-void calculate_results_relevance (const alpm_list_t *targets)
+static int results_added_cmp (const void *p1, const void *p2, void *data)
 {
-	for (const alpm_list_t *t = targets; t; t = alpm_list_next (t)) {
-		const char *target = t->data;
-		for (const alpm_list_t *r = results; r; r = alpm_list_next(r)) {
-			results_t *res = (results_t *) r->data;
-			const char *res_name = results_name (res);
-			const double lev_dst = (double) levenshtein_distance (target, res_name);
-			// calc LCS only if searching by both name and description
-			const size_t lcs = !config.name_only ? longest_common_subseq (target, res_name) : 0;
-			const double rel = lcs ? lev_dst / lcs : lev_dst;
-			res->rel = MIN (res->rel, rel);
-		}
+	const results_t *r1 = p1, *r2 = p2;
+	const int ret = ((alpm_list_fn_cmp) data) (r1->ele, r2->ele);
+	if (ret) {
+		return ret;
 	}
+	return (r1->order < r2->order) - (r1->order > r2->order);
 }
 
-void print_or_add_result (const void *pkg, pkgtype_t type)
+void results_sort_since (size_t mark, alpm_list_fn_cmp fn_cmp)
 {
-	if (config.sort == 0) {
-		print_package ("", pkg, (type == R_ALPM_PKG) ? alpm_pkg_get_str : aur_get_str);
+	if (mark >= results_count || !fn_cmp) {
 		return;
 	}
-
-	results = alpm_list_add (results, results_new (pkg, type));
+	qsort_r (results + mark, results_count - mark, sizeof (results_t),
+			results_added_cmp, (void *) fn_cmp);
+	for (size_t i = mark; i < results_count; i++) {
+		results[i].order = i;
+	}
 }
 
 void show_results (void)
 {
-	if (!results) {
+	if (!results_count) {
 		return;
 	}
 
-	alpm_list_fn_cmp fn_cmp = NULL;
-	switch (config.sort) {
-		case S_NAME:  fn_cmp = results_cmp; break;
-		case S_VOTE:  fn_cmp = results_votes_cmp; break;
-		case S_POP:   fn_cmp = results_popularity_cmp; break;
-		case S_IDATE: fn_cmp = results_installdate_cmp; break;
-		case S_ISIZE: fn_cmp = results_isize_cmp; break;
-		case S_REL:   fn_cmp = results_relevance_cmp; break;
-	}
-	if (fn_cmp) {
-		results = alpm_list_msort (results, alpm_list_count (results), fn_cmp);
+	/* keys are computed once, not on each comparison */
+	if (config.sort == S_NAME) {
+		qsort (results, results_count, sizeof (results_t), results_cmp);
+	} else if (config.sort) {
+		for (size_t i = 0; i < results_count; i++) {
+			results[i].key = results_key (results + i, config.sort);
+		}
+		results_radix_sort (results, results_count);
 	}
 
-	const alpm_list_nav fn_nav = config.rsort ? alpm_list_previous : alpm_list_next;
-	const alpm_list_t *i_first = config.rsort ? alpm_list_last (results) : results;
-
-	for (const alpm_list_t *i = i_first; i; i = fn_nav (i)) {
-		const results_t *r = i->data;
-		if (r && r->type == R_ALPM_PKG) {
-			print_package ("", r->ele, alpm_pkg_get_str);
-		} else if (r && r->type == R_AUR_PKG) {
-			print_package ("", r->ele, aur_get_str);
+	if (format_has_field ('a')) {
+		alpm_list_t *aur_pkgs = NULL;
+		for (size_t i = 0; i < results_count; i++) {
+			if (results[i].type == R_AUR_PKG) {
+				aur_pkgs = alpm_list_add (aur_pkgs, results[i].ele);
+			}
 		}
+		aur_prefetch_arch (aur_pkgs);
+		alpm_list_free (aur_pkgs);
+	}
+
+	for (size_t k = 0; k < results_count; k++) {
+		const results_t *r = results + ((config.rsort) ? results_count - 1 - k : k);
+		print_package ("", r->ele, (r->type == R_ALPM_PKG) ? alpm_pkg_get_str : aur_get_str);
 	}
 
-	alpm_list_free_inner (results, (alpm_list_fn_free) results_free);
-	alpm_list_free (results);
-	results = NULL;
+	results_clear ();
 }
 
 target_t *target_parse (const char *str)
@@ -392,11 +592,226 @@ int target_name_cmp (const target_t *t1, const char *name)
 	return strcmp (t1->name, name);
 }
 
+#define ARENA_BLOCK_SIZE 2048
+#define ARENA_ALIGN      (2 * sizeof (void *))
+
+struct _arena_t
+{
+	struct _arena_t *next;    /* blocks added after the first one */
+	struct _arena_t *current; /* block in use, set in the first block */
+	size_t size;
+	size_t used;
+	char data[] __attribute__ ((aligned (2 * sizeof (void *))));
+};
+
+static arena_t *arena_block_new (size_t size)
+{
+	arena_t *block;
+	MALLOC (block, sizeof (arena_t) + size);
+	block->size = size;
+	return block;
+}
+
+arena_t *arena_new (void)
+{
+	arena_t *arena = arena_block_new (ARENA_BLOCK_SIZE);
+	arena->current = arena;
+	return arena;
+}
+
+void *arena_alloc (arena_t *arena, size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	arena_t *block = arena->current;
+	if (block->size - block->used < size) {
+		block = arena_block_new (MAX (ARENA_BLOCK_SIZE, size));
+		block->next = arena->next;
+		arena->next = block;
+		arena->current = block;
+	}
+	void *ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+char *arena_strndup (arena_t *arena, const char *s, size_t n)
+{
+	char *ret = arena_alloc (arena, n + 1);
+	memcpy (ret, s, n);
+	return ret;
+}
+
+alpm_list_t *arena_list_add (arena_t *arena, alpm_list_t *list, void *data)
+{
+	/* same layout as alpm_list_add(): head->prev is the last item */
+	alpm_list_t *item = arena_alloc (arena, sizeof (alpm_list_t));
+	item->data = data;
+	if (!list) {
+		item->prev = item;
+		return item;
+	}
+	item->prev = list->prev;
+	list->prev->next = item;
+	list->prev = item;
+	return list;
+}
+
+void arena_free (arena_t *arena)
+{
+	while (arena) {
+		arena_t *next = arena->next;
+		free (arena);
+		arena = next;
+	}
+}
+
+unsigned long long str_hash (const char *s)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	for (; *s; s++) {
+		h ^= (unsigned char) *s;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+typedef struct _hash_entry_t
+{
+	const void *key;
+	void *data;
+	unsigned long long hash;
+} hash_entry_t;
+
+/* open addressing, size is a power of 2 and the table is at most half full */
+struct _hash_t
+{
+	hash_entry_t *entries;
+	size_t size;
+	size_t count;
+	bool ptr_keys;
+};
+
+static hash_t *hash_alloc (size_t size, bool ptr_keys)
+{
+	hash_t *hash;
+	MALLOC (hash, sizeof (hash_t));
+	hash->size = 16;
+	while (hash->size < 2 * size) {
+		hash->size <<= 1;
+	}
+	hash->count = 0;
+	hash->ptr_keys = ptr_keys;
+	CALLOC (hash->entries, hash->size, sizeof (hash_entry_t));
+	return hash;
+}
+
+hash_t *hash_new (size_t size)
+{
+	return hash_alloc (size, false);
+}
+
+hash_t *hash_new_ptr (size_t size)
+{
+	return hash_alloc (size, true);
+}
+
+void hash_free (hash_t *hash)
+{
+	if (hash) {
+		free (hash->entries);
+		free (hash);
+	}
+}
+
+/* ptr_hash() mixes pointer bits, low ones are mostly alignment */
+static unsigned long long ptr_hash (const void *p)
+{
+	unsigned long long h = (uintptr_t) p;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static hash_entry_t *hash_lookup (const hash_t *hash, const void *key, unsigned long long h)
+{
+	size_t i = h & (hash->size - 1);
+	while (hash->entries[i].key && (hash->entries[i].hash != h ||
+			((hash->ptr_keys) ? hash->entries[i].key != key : strcmp (hash->entries[i].key, key) != 0))) {
+		i = (i + 1) & (hash->size - 1);
+	}
+	return hash->entries + i;
+}
+
+static void hash_grow (hash_t *hash)
+{
+	hash_entry_t *old = hash->entries;
+	const size_t old_size = hash->size;
+	hash->size <<= 1;
+	CALLOC (hash->entries, hash->size, sizeof (hash_entry_t));
+	for (size_t i = 0; i < old_size; i++) {
+		if (old[i].key) {
+			*hash_lookup (hash, old[i].key, old[i].hash) = old[i];
+		}
+	}
+	free (old);
+}
+
+static void hash_set (hash_t *hash, const void *key, unsigned long long h, void *data)
+{
+	hash_entry_t *entry = hash_lookup (hash, key, h);
+	if (!entry->key) {
+		if (2 * (hash->count + 1) > hash->size) {
+			hash_grow (hash);
+			entry = hash_lookup (hash, key, h);
+		}
+		entry->key = key;
+		entry->hash = h;
+		hash->count++;
+	}
+	entry->data = data;
+}
+
+void hash_add (hash_t *hash, const char *key, void *data)
+{
+	if (hash && key) {
+		hash_set (hash, key, str_hash (key), data);
+	}
+}
+
+void *hash_get (const hash_t *hash, const char *key)
+{
+	if (!hash || !key) {
+		return NULL;
+	}
+	return hash_lookup (hash, key, str_hash (key))->data;
+}
+
+void hash_add_ptr (hash_t *hash, const void *key, void *data)
+{
+	if (hash && key) {
+		hash_set (hash, key, ptr_hash (key), data);
+	}
+}
+
+void *hash_get_ptr (const hash_t *hash, const void *key)
+{
+	if (!hash || !key) {
+		return NULL;
+	}
+	return hash_lookup (hash, key, ptr_hash (key))->data;
+}
+
+size_t hash_count (const hash_t *hash)
+{
+	return (hash) ? hash->count : 0;
+}
+
 string_t *string_new (void)
 {
 	string_t *str;
 	MALLOC (str, sizeof (string_t));
-	str->size = PATH_MAX;
+	str->size = STRING_SIZE;
 	MALLOC (str->s, str->size * sizeof (char));
 	return str;
 }
@@ -410,7 +825,7 @@ void string_free (string_t *dest)
 	FREE (dest);
 }
 
-static char *string_free2 (string_t *dest)
+char *string_free2 (string_t *dest)
 {
 	if (!dest) {
 		return NULL;
@@ -431,8 +846,9 @@ void string_ncat (string_t *dest, const char *src, size_t n)
 		}
 		REALLOC (dest->s, dest->size * sizeof (char));
 	}
+	memcpy (dest->s + dest->used, src, n);
 	dest->used += n;
-	strncat (dest->s, src, n);
+	dest->s[dest->used] = '\0';
 }
 
 void string_cat (string_t *dest, const char *src)
@@ -498,10 +914,11 @@ char *concat_str_list (const alpm_list_t *l)
 	len++; /* '\0' at the end */
 	char *ret;
 	CALLOC (ret, len, sizeof (char));
+	char *p = ret;
 	for (const alpm_list_t *i = l; i; i = alpm_list_next (i)) {
 		if (i->data) {
-			if (i != l) strcat (ret, config.delimiter);
-			strcat (ret, i->data);
+			if (i != l) p = mempcpy (p, config.delimiter, sep_len);
+			p = mempcpy (p, i->data, strlen (i->data));
 		}
 	}
 
@@ -544,11 +961,12 @@ char *concat_file_list (const alpm_filelist_t *f)
 	len++; /* '\0' at the end */
 	char *ret;
 	CALLOC (ret, len, sizeof (char));
+	char *p = ret;
 	for (size_t i = 0; i < f->count; i++) {
 		const alpm_file_t *file = f->files + i;
 		if (file && file->name) {
-			if (i != 0) strcat (ret, config.delimiter);
-			strcat (ret, file->name);
+			if (i != 0) p = mempcpy (p, config.delimiter, sep_len);
+			p = mempcpy (p, file->name, strlen (file->name));
 		}
 	}
 
@@ -637,49 +1055,33 @@ char *ttostr (time_t t)
 	return ts;
 }
 
-/* Helper function for strreplace */
-static void _strnadd (char **str, const char *append, size_t count)
-{
-	if (!str) {
-		return;
-	}
-
-	if (*str) {
-		REALLOC (*str, strlen (*str) + count + 1);
-	} else {
-		CALLOC (*str, sizeof (char), count + 1);
-	}
-
-	strncat (*str, append, count);
-}
-
 /* Replace all occurances of 'needle' with 'replace' in 'str', returning
  * a new string (must be free'd) */
 char *strreplace (const char *str, const char *needle, const char *replace)
 {
 	const char *p = str, *q = str;
-	char *newstr = NULL;
+	string_t *newstr = string_new ();
 	const size_t needlesz = strlen (needle), replacesz = strlen (replace);
 
 	while (true) {
 		q = strstr (p, needle);
 		if (!q) { /* not found */
-			if (*p) {
-				/* add the rest of 'p' */
-				_strnadd (&newstr, p, strlen (p));
-			}
+			/* add the rest of 'p' */
+			string_cat (newstr, p);
 			break;
 		} else { /* found match */
-			if (q > p) {
-				/* add chars between this occurance and last occurance, if any */
-				_strnadd (&newstr, p, q - p);
-			}
-			_strnadd (&newstr, replace, replacesz);
+			/* add chars between this occurance and last occurance, if any */
+			string_ncat (newstr, p, q - p);
+			string_ncat (newstr, replace, replacesz);
 			p = q + needlesz;
 		}
 	}
 
-	return newstr;
+	if (!newstr->used) {
+		string_free (newstr);
+		return NULL;
+	}
+	return string_free2 (newstr);
 }
 
 /** Parse the basename of a program from a path.
@@ -856,7 +1258,7 @@ static void color_print_package (const void *p, printpkgfn f)
 	 *   C_OD if package exists and is out of date
 	 *   C_VER otherwise
 	 */
-	const char *lver = alpm_local_pkg_get_str (info, 'l');
+	const char *lver = alpm_local_pkg_get_str (alpm_local_pkg (info), 'l');
 	info = f (p, (config.aur_upgrades || config.filter & F_UPGRADES) ? 'V' : 'v');
 	char *ver = STRDUP (info);
 	info = (aur) ? f (p, 'm') : NULL;
@@ -932,7 +1334,7 @@ void print_package (const char *target, const void *pkg, printpkgfn f)
 		return;
 	}
 
-	char *s = pkg_to_str (target, pkg, f, config.format_out);
+	const char *s = pkg_to_str (config.format_out, target, pkg, f);
 	if (!s) {
 		return;
 	}
@@ -942,50 +1344,145 @@ void print_package (const char *target, const void *pkg, printpkgfn f)
 	} else {
 		printf ("%s\n", s);
 	}
-	free (s);
 	fflush (NULL);
 }
 
-char *pkg_to_str (const char *target, const void *pkg, printpkgfn f, const char *format)
+typedef enum
+{
+	FMT_TEXT,
+	FMT_FIELD,
+	FMT_LOCAL,   /* field of the installed package */
+	FMT_TARGET
+} fmtop_t;
+
+typedef struct _fmtinsn_t
+{
+	fmtop_t op;
+	unsigned char field;
+	const char *text;
+	size_t len;
+} fmtinsn_t;
+
+struct _format_t
+{
+	char *format;
+	fmtinsn_t *insns;
+	size_t count;
+	string_t *out;   /* reused by each pkg_to_str() */
+};
+
+static void format_add (format_t *fmt, fmtop_t op, unsigned char field,
+		const char *text, size_t len)
+{
+	fmtinsn_t *insn = fmt->insns + fmt->count++;
+	insn->op = op;
+	insn->field = field;
+	insn->text = text;
+	insn->len = len;
+}
+
+format_t *format_new (const char *format)
 {
 	if (!format) {
 		return NULL;
 	}
-	const char *c;
-	string_t *ret = string_new ();
-	const char *ptr = format;
-	const char *end = &(format[strlen(format)]);
-	while ((c = strchr (ptr, '%'))) {
-		if (&(c[1]) == end) {
-			break;
-		}
+	format_t *fmt;
+	MALLOC (fmt, sizeof (format_t));
+	fmt->format = strdup (format);
+	/* at most one text before each field, plus the last one */
+	size_t fields = 0;
+	for (const char *c = format; (c = strchr (c, '%')) && c[1]; c += 2) {
+		fields++;
+	}
+	CALLOC (fmt->insns, 2 * fields + 1, sizeof (fmtinsn_t));
+	fmt->out = string_new ();
+
+	/* "%%" is kept as is, like a trailing '%' */
+	const char *span = fmt->format;
+	const char *c = fmt->format;
+	while ((c = strchr (c, '%')) && c[1]) {
 		if (c[1] == '%') {
-			string_ncat (ret, ptr, (c-ptr));
-			string_cat (ret, "%%");
+			c += 2;
+			continue;
+		}
+		if (c != span) {
+			format_add (fmt, FMT_TEXT, 0, span, c - span);
+		}
+		if (strchr (FORMAT_LOCAL_PKG, c[1])) {
+			format_add (fmt, FMT_LOCAL, c[1], NULL, 0);
+		} else if (c[1] == 't') {
+			format_add (fmt, FMT_TARGET, c[1], NULL, 0);
 		} else {
-			const char *info = NULL;
-			if (strchr (FORMAT_LOCAL_PKG, c[1])) {
-				info = alpm_local_pkg_get_str (f (pkg, 'n'), c[1]);
-			} else if (c[1] == 't') {
-				info = target;
-			} else {
-				info = f (pkg, c[1]);
-			}
-			if (c != ptr) {
-				string_ncat (ret, ptr, (c-ptr));
-			}
-			if (info) {
-				string_cat (ret, info);
-			} else {
-				string_cat (ret, "-");
-			}
+			format_add (fmt, FMT_FIELD, c[1], NULL, 0);
+		}
+		c += 2;
+		span = c;
+	}
+	if (*span) {
+		format_add (fmt, FMT_TEXT, 0, span, strlen (span));
+	}
+	return fmt;
+}
+
+void format_free (format_t *fmt)
+{
+	if (!fmt) {
+		return;
+	}
+	free (fmt->format);
+	free (fmt->insns);
+	string_free (fmt->out);
+	free (fmt);
+}
+
+bool format_has_field (unsigned char c)
+{
+	if (!config.custom_out || !config.format_out) {
+		return false;
+	}
+	for (size_t i = 0; i < config.format_out->count; i++) {
+		if (config.format_out->insns[i].op != FMT_TEXT && config.format_out->insns[i].field == c) {
+			return true;
 		}
-		ptr = &(c[2]);
 	}
-	if (ptr != end) {
-		string_ncat (ret, ptr, (end - ptr));
+	return false;
+}
+
+const char *pkg_to_str (format_t *fmt, const char *target, const void *pkg, printpkgfn f)
+{
+	if (!fmt) {
+		return NULL;
 	}
-	return string_free2 (ret);
+	string_t *ret = fmt->out;
+	ret->used = 0;
+	ret->s[0] = '\0';
+	/* installed package is looked up once per row */
+	alpm_pkg_t *local_pkg = NULL;
+	bool local_resolved = false;
+	for (size_t i = 0; i < fmt->count; i++) {
+		const fmtinsn_t *insn = fmt->insns + i;
+		const char *info = NULL;
+		switch (insn->op) {
+			case FMT_TEXT:
+				string_ncat (ret, insn->text, insn->len);
+				continue;
+			case FMT_LOCAL:
+				if (!local_resolved) {
+					local_pkg = alpm_local_pkg (f (pkg, 'n'));
+					local_resolved = true;
+				}
+				info = alpm_local_pkg_get_str (local_pkg, insn->field);
+				break;
+			case FMT_TARGET:
+				info = target;
+				break;
+			case FMT_FIELD:
+				info = f (pkg, insn->field);
+				break;
+		}
+		string_cat (ret, (info) ? info : "-");
+	}
+	return string_cstr (ret);
 }
 
 target_arg_t *target_arg_init (ta_dup_fn dup_fn, alpm_list_fn_cmp cmp_fn,
@@ -1049,33 +1546,303 @@ alpm_list_t *target_arg_close (target_arg_t *t, alpm_list_t *targets)
 	return targets;
 }
 
-bool does_name_contain_targets (const alpm_list_t *targets, const char *name, bool use_regex)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define REGEX_META "^$.[]|()*+?{}\\"
+/* Literal targets scanned together, one bit each */
+#define MATCHER_LITERALS 64
+/* Distinct first bytes of literals for the SSE2 skip loop */
+#define MATCHER_STARTS 8
+/* Beyond this many literals, one strcasestr() per target is faster:
+ * it stops at the first missing one (see test/bench-matcher) */
+#define MATCHER_SCAN_MAX 2
+
+typedef struct _pattern_t
+{
+	const char *str;
+	char *folded;  /* literal in lower case */
+	size_t len;
+	bool literal;
+	regex_t reg;
+} pattern_t;
+
+struct _matcher_t
+{
+	pattern_t *patterns;
+	size_t count;
+	bool valid;  /* false if a target is not a valid regex */
+	uint64_t literals;  /* patterns matched by literal_scan() */
+	uint64_t first[UCHAR_MAX+1];  /* literals by folded first byte */
+	unsigned char starts[MATCHER_STARTS];
+	size_t nstarts;  /* 0 if too many to skip with SSE2 */
+#ifdef __SSE2__
+	/* starts[] for literal_skip(), letters are compared in lower case */
+	__m128i skip_or[MATCHER_STARTS];
+	__m128i skip_eq[MATCHER_STARTS];
+#endif
+};
+
+/* Only ASCII is folded, like strcasestr() does with UTF-8 */
+static inline unsigned char fold (unsigned char c)
 {
-	if (!targets || !name) {
-		return false;
+	return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+/* ascii_case_only() returns true if the locale changes the case of ASCII only */
+static bool ascii_case_only (void)
+{
+	for (int c = 0x80; c <= UCHAR_MAX; c++) {
+		if (tolower (c) != c || toupper (c) != c) {
+			return false;
+		}
 	}
+	return true;
+}
 
+matcher_t *matcher_new (const alpm_list_t *targets, bool use_regex)
+{
+	matcher_t *matcher;
+	MALLOC (matcher, sizeof (matcher_t));
+	CALLOC (matcher->patterns, alpm_list_count (targets) + 1, sizeof (pattern_t));
+	matcher->count = 0;
+	matcher->valid = true;
+	/* folded bytes give the same answers as strcasestr(), and as a
+	 * REG_ICASE regex in a single byte locale (multibyte ones fold
+	 * other characters, like U+017F to 's') */
+	const bool ascii_case = ascii_case_only ();
+	const bool plain_regex = ascii_case && MB_CUR_MAX == 1;
+	bool too_many_starts = false;
 	for (const alpm_list_t *t = targets; t; t = alpm_list_next (t)) {
-		const char *target = (const char *)(t->data);
-		if (!target) {
+		const char *target = (const char *) t->data;
+		if (!target || !target[0]) {
 			continue;
 		}
+		pattern_t *pattern = matcher->patterns + matcher->count;
+		pattern->str = target;
+		pattern->literal = !use_regex || (plain_regex && strpbrk (target, REGEX_META) == NULL);
+		if (!pattern->literal) {
+			if (regcomp (&(pattern->reg), target,
+					REG_EXTENDED | REG_NOSUB | REG_ICASE | REG_NEWLINE) != 0) {
+				matcher->valid = false;
+				break;
+			}
+		} else if (ascii_case && matcher->count < MATCHER_LITERALS) {
+			pattern->len = strlen (target);
+			MALLOC (pattern->folded, pattern->len + 1);
+			for (size_t i = 0; i < pattern->len; i++) {
+				pattern->folded[i] = fold (target[i]);
+			}
+			const unsigned char c = pattern->folded[0];
+			if (!matcher->first[c] && !too_many_starts) {
+				if (matcher->nstarts < MATCHER_STARTS) {
+					matcher->starts[matcher->nstarts++] = c;
+				} else {
+					too_many_starts = true;
+				}
+			}
+			matcher->first[c] |= (uint64_t) 1 << matcher->count;
+			matcher->literals |= (uint64_t) 1 << matcher->count;
+		}
+		matcher->count++;
+	}
+	if (too_many_starts) {
+		matcher->nstarts = 0;
+	}
+#ifdef __SSE2__
+	if (__builtin_popcountll (matcher->literals) > MATCHER_SCAN_MAX) {
+		matcher->literals = 0;
+	}
+	for (size_t k = 0; k < matcher->nstarts; k++) {
+		const unsigned char c = matcher->starts[k];
+		matcher->skip_or[k] = _mm_set1_epi8 ((c >= 'a' && c <= 'z') ? 0x20 : 0);
+		matcher->skip_eq[k] = _mm_set1_epi8 ((char) c);
+	}
+#else
+	/* without SSE2 skip, literal_scan() is slower than strcasestr() */
+	matcher->literals = 0;
+#endif
+	return matcher;
+}
+
+void matcher_free (matcher_t *matcher)
+{
+	if (!matcher) {
+		return;
+	}
+	for (size_t i = 0; i < matcher->count; i++) {
+		if (!matcher->patterns[i].literal) {
+			regfree (&(matcher->patterns[i].reg));
+		}
+		free (matcher->patterns[i].folded);
+	}
+	free (matcher->patterns);
+	free (matcher);
+}
+
+/* matcher_no_scan() is for tests only (declared in test/test.h):
+ * literals are then matched one by one with strcasestr() */
+void matcher_no_scan (matcher_t *matcher)
+{
+	if (matcher) {
+		matcher->literals = 0;
+	}
+}
 
-		if (use_regex) {
-			regex_t reg;
-			if (regcomp (&reg, target, REG_EXTENDED | REG_NOSUB | REG_ICASE | REG_NEWLINE) != 0) {
-				return false;
+#ifdef __SSE2__
+/* literal_skip() returns the first position from p holding either
+ * the end of string or a byte that may start a literal.
+ * Loads are aligned so they never cross into the next page, but they
+ * read around the string: ASan is told to ignore this function, and
+ * valgrind accepts such loads (--partial-loads-ok, its default).
+ */
+__attribute__ ((no_sanitize_address))
+static const char *literal_skip (const matcher_t *matcher, const char *p)
+{
+	const size_t shift = (uintptr_t) p & 15;
+	const __m128i *block = (const __m128i *) (p - shift);
+	unsigned int bits = ~0U << shift;
+	for (;; block++, bits = ~0U) {
+		const __m128i v = _mm_load_si128 (block);
+		__m128i hits = _mm_cmpeq_epi8 (v, _mm_setzero_si128 ());
+		for (size_t k = 0; k < matcher->nstarts; k++) {
+			hits = _mm_or_si128 (hits, _mm_cmpeq_epi8 (
+					_mm_or_si128 (v, matcher->skip_or[k]), matcher->skip_eq[k]));
+		}
+		bits &= (unsigned int) _mm_movemask_epi8 (hits);
+		if (bits) {
+			return (const char *) block + __builtin_ctz (bits);
+		}
+	}
+}
+#endif
+
+/* literal_scan() returns the literals of todo found in s, in one pass */
+static uint64_t literal_scan (const matcher_t *matcher, const char *s, uint64_t todo)
+{
+	uint64_t found = 0;
+	if (!s) {
+		return found;
+	}
+	for (const char *p = s; ; p++) {
+#ifdef __SSE2__
+		if (matcher->nstarts) {
+			p = literal_skip (matcher, p);
+		}
+#endif
+		if (!*p) {
+			break;
+		}
+		uint64_t candidates = matcher->first[fold (*p)] & todo & ~found;
+		while (candidates) {
+			const int i = __builtin_ctzll (candidates);
+			const pattern_t *pattern = matcher->patterns + i;
+			size_t j = 1;
+			/* end of string never matches a folded byte */
+			while (j < pattern->len && fold (p[j]) == (unsigned char) pattern->folded[j]) {
+				j++;
 			}
-			if (regexec (&reg, name, 0, 0, 0) != 0 && strstr (name, target) == NULL) {
-				regfree (&reg);
-				return false;
+			if (j == pattern->len) {
+				found |= (uint64_t) 1 << i;
 			}
-			regfree (&reg);
-		} else if (strcasestr (name, target) == NULL) {
+			candidates &= candidates - 1;
+		}
+		if (found == todo) {
+			break;
+		}
+	}
+	return found;
+}
+
+static bool pattern_match (const pattern_t *pattern, const char *s)
+{
+	if (!s) {
+		return false;
+	}
+	if (pattern->literal) {
+		return strcasestr (s, pattern->str) != NULL;
+	}
+	return regexec (&(pattern->reg), s, 0, 0, 0) == 0 || strstr (s, pattern->str) != NULL;
+}
+
+bool matcher_match (const matcher_t *matcher, const char *name, const char *desc)
+{
+	if (!matcher || !matcher->valid) {
+		return false;
+	}
+	if (matcher->literals) {
+		uint64_t found = literal_scan (matcher, name, matcher->literals);
+		if (found != matcher->literals) {
+			found |= literal_scan (matcher, desc, matcher->literals & ~found);
+		}
+		if (found != matcher->literals) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < matcher->count; i++) {
+		if (i < MATCHER_LITERALS && (matcher->literals & ((uint64_t) 1 << i))) {
+			continue;
+		}
+		if (!pattern_match (matcher->patterns + i, name) &&
+				!pattern_match (matcher->patterns + i, desc)) {
 			return false;
 		}
 	}
+	return true;
+}
+
+/* pattern_field_match() is regex only, like alpm_db_search() does for
+ * all fields but name */
+static bool pattern_field_match (const pattern_t *pattern, const char *s)
+{
+	if (!s) {
+		return false;
+	}
+	if (pattern->literal) {
+		return strcasestr (s, pattern->str) != NULL;
+	}
+	return regexec (&(pattern->reg), s, 0, 0, 0) == 0;
+}
 
+bool matcher_match_pkg (const matcher_t *matcher, const char *name, const char *desc,
+                        const alpm_list_t *provides, const alpm_list_t *groups)
+{
+	if (!matcher || !matcher->valid) {
+		return false;
+	}
+	if (matcher->literals) {
+		uint64_t found = literal_scan (matcher, name, matcher->literals);
+		if (found != matcher->literals) {
+			found |= literal_scan (matcher, desc, matcher->literals & ~found);
+		}
+		for (const alpm_list_t *p = provides; p && found != matcher->literals; p = alpm_list_next (p)) {
+			const alpm_depend_t *provide = p->data;
+			found |= literal_scan (matcher, provide->name, matcher->literals & ~found);
+		}
+		for (const alpm_list_t *g = groups; g && found != matcher->literals; g = alpm_list_next (g)) {
+			found |= literal_scan (matcher, g->data, matcher->literals & ~found);
+		}
+		if (found != matcher->literals) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < matcher->count; i++) {
+		if (i < MATCHER_LITERALS && (matcher->literals & ((uint64_t) 1 << i))) {
+			continue;
+		}
+		const pattern_t *pattern = matcher->patterns + i;
+		bool matched = pattern_match (pattern, name) || pattern_field_match (pattern, desc);
+		for (const alpm_list_t *p = provides; p && !matched; p = alpm_list_next (p)) {
+			matched = pattern_field_match (pattern, ((const alpm_depend_t *) p->data)->name);
+		}
+		for (const alpm_list_t *g = groups; g && !matched; g = alpm_list_next (g)) {
+			matched = pattern_field_match (pattern, g->data);
+		}
+		if (!matched) {
+			return false;
+		}
+	}
 	return true;
 }
 
@@ -1086,10 +1853,256 @@ static size_t curl_getdata_cb (void *data, size_t size, size_t nmemb, void *user
 	return size * nmemb;
 }
 
+static int cache_param_cmp (const void *p1, const void *p2)
+{
+	return strcmp (*(char * const *) p1, *(char * const *) p2);
+}
+
+/* cache_key() sorts query parameters, so that the same request
+ * always gets the same key */
+static char *cache_key (const char *url)
+{
+	const char *query = strchr (url, '?');
+	if (!query) {
+		return strdup (url);
+	}
+
+	char *params = strdup (query + 1);
+	size_t count = 1;
+	for (const char *c = params; *c; c++) {
+		if (*c == '&') count++;
+	}
+	char **argv;
+	CALLOC (argv, count, sizeof (char *));
+	size_t n = 0;
+	char *saveptr = NULL;
+	for (char *p = strtok_r (params, "&", &saveptr); p; p = strtok_r (NULL, "&", &saveptr)) {
+		argv[n++] = p;
+	}
+	qsort (argv, n, sizeof (char *), cache_param_cmp);
+
+	string_t *key = string_new ();
+	string_ncat (key, url, query - url + 1);
+	for (size_t i = 0; i < n; i++) {
+		if (i) string_cat (key, "&");
+		string_cat (key, argv[i]);
+	}
+	free (argv);
+	free (params);
+	return string_free2 (key);
+}
+
+static void cache_entry_free (cache_entry_t *entry)
+{
+	if (!entry) {
+		return;
+	}
+	FREE (entry->key);
+	FREE (entry->path);
+	FREE (entry->body);
+	FREE (entry->etag);
+	FREE (entry->lastmod);
+	FREE (entry->version);
+	FREE (entry->new_etag);
+	FREE (entry->new_lastmod);
+	curl_slist_free_all (entry->headers);
+	FREE (entry);
+}
+
+/* Read one header line of a cache file, '\n' removed */
+static char *cache_read_line (FILE *fp)
+{
+	char *line = NULL;
+	size_t n = 0;
+	const ssize_t len = getline (&line, &n, fp);
+	if (len <= 0) {
+		FREE (line);
+		return NULL;
+	}
+	if (line[len-1] == '\n') {
+		line[len-1] = '\0';
+	}
+	return line;
+}
+
+/* cache_open() returns NULL if cache is disabled.
+ * entry->body is NULL if url is not in cache,
+ * or if a CACHE_KEEP body was stored for another version.
+ */
+static cache_entry_t *cache_open (const char *url, cachemode_t mode, const char *version)
+{
+	if (!config.cache_dir || !url) {
+		return NULL;
+	}
+
+	cache_entry_t *entry;
+	MALLOC (entry, sizeof (cache_entry_t));
+	entry->key = cache_key (url);
+	entry->version = (version) ? strdup (version) : NULL;
+	if (asprintf (&entry->path, "%s/%016llx", config.cache_dir, str_hash (entry->key)) < 0) {
+		entry->path = NULL;
+		cache_entry_free (entry);
+		return NULL;
+	}
+
+	FILE *fp = fopen (entry->path, "r");
+	if (!fp) {
+		return entry;
+	}
+
+	struct stat st;
+	char *magic = cache_read_line (fp);
+	char *key = cache_read_line (fp);
+	entry->etag = cache_read_line (fp);
+	entry->lastmod = cache_read_line (fp);
+	char *stored_version = cache_read_line (fp);
+	if (mode == CACHE_KEEP && stored_version && version &&
+			strcmp (stored_version, version) != 0) {
+		/* another version of the document: fetch it again, unconditionally */
+		FREE (entry->etag);
+		FREE (entry->lastmod);
+	} else if (magic && key && stored_version && strcmp (magic, CACHE_MAGIC) == 0 &&
+			strcmp (key, entry->key) == 0 && fstat (fileno (fp), &st) == 0) {
+		const long offset = ftell (fp);
+		if (offset >= 0 && st.st_size >= offset) {
+			entry->body_len = st.st_size - offset;
+			CALLOC (entry->body, entry->body_len + 1, sizeof (char));
+			if (fread (entry->body, 1, entry->body_len, fp) != entry->body_len) {
+				FREE (entry->body);
+			}
+		}
+		entry->fresh = (entry->body && (mode == CACHE_KEEP ||
+				time (NULL) - st.st_mtime < (time_t) config.cache_ttl));
+	}
+	if (entry->etag && entry->etag[0] == '\0') FREE (entry->etag);
+	if (entry->lastmod && entry->lastmod[0] == '\0') FREE (entry->lastmod);
+	free (magic);
+	free (key);
+	free (stored_version);
+	fclose (fp);
+	return entry;
+}
+
+/* cache_store() writes a new body for entry, replacing the old file atomically */
+static void cache_store (cache_entry_t *entry, const char *body, size_t len)
+{
+	CACHE_STAT (misses);
+	if (mkdir (config.cache_dir, 0755) != 0 && errno != EEXIST) {
+		fprintf (stderr, "cache: unable to create %s (%s)\n", config.cache_dir, strerror (errno));
+		return;
+	}
+
+	/* unique name, the prefetch thread may store the same url */
+	char *tmp = NULL;
+	if (asprintf (&tmp, "%s.XXXXXX", entry->path) < 0) {
+		return;
+	}
+	const int fd = mkstemp (tmp);
+	if (fd < 0) {
+		free (tmp);
+		return;
+	}
+	FILE *fp = fdopen (fd, "w");
+	if (!fp) {
+		close (fd);
+		unlink (tmp);
+		free (tmp);
+		return;
+	}
+	fprintf (fp, "%s\n%s\n%s\n%s\n%s\n", CACHE_MAGIC, entry->key,
+			(entry->new_etag) ? entry->new_etag : "",
+			(entry->new_lastmod) ? entry->new_lastmod : "",
+			(entry->version) ? entry->version : "");
+	const bool written = (fwrite (body, 1, len, fp) == len);
+	if (fclose (fp) != 0 || !written || rename (tmp, entry->path) != 0) {
+		unlink (tmp);
+	}
+	free (tmp);
+}
+
+/* cache_not_modified() returns true if server validated the cached body */
+static bool cache_not_modified (cache_entry_t *entry, CURL *curl, CURLcode curl_code)
+{
+	if (!entry || !entry->body || curl_code != CURLE_OK) {
+		return false;
+	}
+	long http_code;
+	curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+	if (http_code != 304) {
+		return false;
+	}
+	CACHE_STAT (revalidated);
+	utime (entry->path, NULL);
+	return true;
+}
+
+static size_t cache_header_cb (char *buffer, size_t size, size_t nitems, void *userdata)
+{
+	cache_entry_t *entry = (cache_entry_t *) userdata;
+	const size_t len = size * nitems;
+	char **field = NULL;
+	size_t offset = 0;
+	if (len > strlen ("ETag:") && strncasecmp (buffer, "ETag:", strlen ("ETag:")) == 0) {
+		field = &(entry->new_etag);
+		offset = strlen ("ETag:");
+	} else if (len > strlen ("Last-Modified:") &&
+			strncasecmp (buffer, "Last-Modified:", strlen ("Last-Modified:")) == 0) {
+		field = &(entry->new_lastmod);
+		offset = strlen ("Last-Modified:");
+	}
+	if (field) {
+		const char *value = buffer + offset;
+		size_t value_len = len - offset;
+		while (value_len && isspace (*value)) {
+			value++;
+			value_len--;
+		}
+		while (value_len && isspace (value[value_len-1])) {
+			value_len--;
+		}
+		free (*field);
+		*field = strndup (value, value_len);
+	}
+	return len;
+}
+
+/* cache_prepare() sets conditional request headers for a stale entry */
+static void cache_prepare (cache_entry_t *entry, CURL *curl)
+{
+	if (entry->body) {
+		char *header = NULL;
+		if (entry->etag && asprintf (&header, "If-None-Match: %s", entry->etag) > 0) {
+			entry->headers = curl_slist_append (entry->headers, header);
+			free (header);
+		}
+		if (entry->lastmod && asprintf (&header, "If-Modified-Since: %s", entry->lastmod) > 0) {
+			entry->headers = curl_slist_append (entry->headers, header);
+			free (header);
+		}
+	}
+	curl_easy_setopt (curl, CURLOPT_HTTPHEADER, entry->headers);
+	curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, cache_header_cb);
+	curl_easy_setopt (curl, CURLOPT_HEADERDATA, entry);
+}
+
+static void cache_reset (CURL *curl)
+{
+	curl_easy_setopt (curl, CURLOPT_HTTPHEADER, NULL);
+	curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, NULL);
+	curl_easy_setopt (curl, CURLOPT_HEADERDATA, NULL);
+}
+
+void cache_print_stats (void)
+{
+	fprintf (stderr, "cache: %u hits, %u revalidated, %u misses\n",
+			cache_stats.hits, cache_stats.revalidated, cache_stats.misses);
+}
+
 CURL *curl_init (long flags)
 {
 	if (curl_config.curl) {
-		if (curl_config.flags == flags) {
+		/* an SSL handle does for plain http too */
+		if ((curl_config.flags & flags) == flags) {
 			return curl_config.curl;
 		}
 
@@ -1119,23 +2132,31 @@ CURL *curl_init (long flags)
 	return curl_config.curl;
 }
 
-char *curl_fetch (CURL *curl, const char *url)
+/* curl_check() reports transfer and HTTP errors, returns true on success */
+static bool curl_check (CURL *curl, CURLcode curl_code, const char *url)
 {
-	string_t *res = string_new ();
-	curl_easy_setopt (curl, CURLOPT_WRITEDATA, res);
-	curl_easy_setopt (curl, CURLOPT_URL, url);
-
-	CURLcode curl_code;
-	if ((curl_code = curl_easy_perform (curl)) != CURLE_OK) {
+	if (curl_code != CURLE_OK) {
 		fprintf(stderr, "curl error: %s\n", curl_easy_strerror (curl_code));
-		string_free (res);
-		return NULL;
+		return false;
 	}
 
 	long http_code;
 	curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
 	if (http_code != 200) {
 		fprintf(stderr, "The URL %s returned error : %ld\n", url, http_code);
+		return false;
+	}
+
+	return true;
+}
+
+char *curl_fetch (CURL *curl, const char *url)
+{
+	string_t *res = string_new ();
+	curl_easy_setopt (curl, CURLOPT_WRITEDATA, res);
+	curl_easy_setopt (curl, CURLOPT_URL, url);
+
+	if (!curl_check (curl, curl_easy_perform (curl), url)) {
 		string_free (res);
 		return NULL;
 	}
@@ -1143,6 +2164,186 @@ char *curl_fetch (CURL *curl, const char *url)
 	return string_free2 (res);
 }
 
+/* Streamed transfer of curl_fetch_stream() */
+typedef struct _curl_stream_t
+{
+	CURL *curl;
+	curl_stream_fn fn;
+	void *data;
+	bool ok;
+	string_t *copy;
+} curl_stream_t;
+
+static size_t curl_stream_cb (void *data, size_t size, size_t nmemb, void *userdata)
+{
+	curl_stream_t *stream = (curl_stream_t *) userdata;
+	long http_code = 0;
+	curl_easy_getinfo (stream->curl, CURLINFO_RESPONSE_CODE, &http_code);
+	/* error pages are not given to the consumer */
+	if (http_code == 200 && stream->ok) {
+		stream->ok = stream->fn ((const char *) data, size * nmemb, stream->data);
+		if (stream->copy) {
+			string_ncat (stream->copy, data, size * nmemb);
+		}
+	}
+	return size * nmemb;
+}
+
+bool curl_fetch_stream (CURL *curl, const char *url, curl_stream_fn fn, void *data, cachemode_t cache)
+{
+	cache_entry_t *entry = (cache != CACHE_OFF) ? cache_open (url, cache, NULL) : NULL;
+	if (entry && entry->fresh) {
+		CACHE_STAT (hits);
+		fn (entry->body, entry->body_len, data);
+		cache_entry_free (entry);
+		return true;
+	}
+
+	curl_stream_t stream = {curl, fn, data, true, (entry) ? string_new () : NULL};
+	curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, curl_stream_cb);
+	curl_easy_setopt (curl, CURLOPT_WRITEDATA, &stream);
+	curl_easy_setopt (curl, CURLOPT_URL, url);
+	if (entry) {
+		cache_prepare (entry, curl);
+	}
+
+	bool ret = true;
+	const CURLcode curl_code = curl_easy_perform (curl);
+	if (cache_not_modified (entry, curl, curl_code)) {
+		fn (entry->body, entry->body_len, data);
+	} else {
+		ret = curl_check (curl, curl_code, url);
+		if (ret && entry && stream.ok) {
+			cache_store (entry, stream.copy->s, stream.copy->used);
+		}
+	}
+
+	curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, curl_getdata_cb);
+	if (entry) {
+		cache_reset (curl);
+		cache_entry_free (entry);
+		string_free (stream.copy);
+	}
+	return ret;
+}
+
+/* One transfer of curl_multi_fetch() */
+typedef struct _curl_transfer_t
+{
+	CURL *curl;
+	const char *url;
+	string_t *res;
+	cache_entry_t *entry;
+	bool done;
+	bool not_modified;
+} curl_transfer_t;
+
+alpm_list_t *curl_multi_fetch (CURL *curl, const alpm_list_t *urls, long max_conn,
+		cachemode_t cache, const alpm_list_t *versions)
+{
+	const size_t count = alpm_list_count (urls);
+	if (!count) {
+		return NULL;
+	}
+
+	CURLM *multi = curl_multi_init ();
+	if (!multi) {
+		perror ("curl multi");
+		return NULL;
+	}
+	if (max_conn > 0) {
+		curl_multi_setopt (multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, max_conn);
+	}
+
+	curl_transfer_t *transfers;
+	CALLOC (transfers, count, sizeof (curl_transfer_t));
+	size_t k = 0;
+	const alpm_list_t *v = versions;
+	for (const alpm_list_t *u = urls; u; u = alpm_list_next (u), k++) {
+		curl_transfer_t *tr = transfers + k;
+		const char *version = (v) ? v->data : NULL;
+		v = alpm_list_next (v);
+		tr->url = u->data;
+		tr->entry = (cache != CACHE_OFF && tr->url) ? cache_open (tr->url, cache, version) : NULL;
+		if (tr->entry && tr->entry->fresh) {
+			CACHE_STAT (hits);
+			tr->done = tr->not_modified = true;
+			continue;
+		}
+		/* duplicated handles inherit curl_init() options */
+		if (!tr->url || (tr->curl = curl_easy_duphandle (curl)) == NULL) {
+			continue;
+		}
+		tr->res = string_new ();
+		curl_easy_setopt (tr->curl, CURLOPT_WRITEDATA, tr->res);
+		curl_easy_setopt (tr->curl, CURLOPT_URL, tr->url);
+		curl_easy_setopt (tr->curl, CURLOPT_PRIVATE, tr);
+		if (tr->entry) {
+			cache_prepare (tr->entry, tr->curl);
+		}
+		curl_multi_add_handle (multi, tr->curl);
+	}
+
+	int running = 0;
+	do {
+		CURLMcode mc = curl_multi_perform (multi, &running);
+		if (mc == CURLM_OK && running) {
+			mc = curl_multi_wait (multi, NULL, 0, 1000, NULL);
+		}
+		if (mc != CURLM_OK) {
+			fprintf(stderr, "curl error: %s\n", curl_multi_strerror (mc));
+			break;
+		}
+
+		CURLMsg *msg;
+		int msgs_left;
+		while ((msg = curl_multi_info_read (multi, &msgs_left))) {
+			curl_transfer_t *tr = NULL;
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+			curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, (char **) &tr);
+			if (!tr) {
+				continue;
+			}
+			if (cache_not_modified (tr->entry, tr->curl, msg->data.result)) {
+				tr->done = tr->not_modified = true;
+			} else {
+				tr->done = curl_check (tr->curl, msg->data.result, tr->url);
+				if (tr->done && tr->entry) {
+					cache_store (tr->entry, tr->res->s, tr->res->used);
+				}
+			}
+		}
+	} while (running);
+
+	/* results are returned in urls order, NULL for failed transfers */
+	alpm_list_t *ret = NULL;
+	for (k = 0; k < count; k++) {
+		curl_transfer_t *tr = transfers + k;
+		char *res = NULL;
+		if (tr->curl) {
+			curl_multi_remove_handle (multi, tr->curl);
+			curl_easy_cleanup (tr->curl);
+		}
+		if (tr->not_modified) {
+			res = tr->entry->body;
+			tr->entry->body = NULL;
+			string_free (tr->res);
+		} else if (tr->done) {
+			res = string_free2 (tr->res);
+		} else {
+			string_free (tr->res);
+		}
+		cache_entry_free (tr->entry);
+		ret = alpm_list_add (ret, res);
+	}
+
+	free (transfers);
+	curl_multi_cleanup (multi);
+	return ret;
+}
+
 void curl_cleanup (void)
 {
 	if (curl_config.curl) {
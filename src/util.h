@@ -90,6 +90,9 @@ typedef enum
 /* Results FD */
 #define FD_RES 3
 
+/* Default lifetime of cached responses, in seconds */
+#define CACHE_TTL 60
+
 /* Sort options */
 typedef enum
 {
@@ -103,24 +106,32 @@ typedef enum
 
 #define SEP_LEN 10
 
+/* Compiled output format (-f), see format_new() */
+typedef struct _format_t format_t;
+
 /*
  * General config
  */
 typedef struct _aq_config
 {
 	char *arch;
+	char *aur_import;
+	char *aur_index;
 	char *aur_url;
+	char *cache_dir;
 	char *configfile;
 	char *dbpath;
-	char *format_out;
+	format_t *format_out;
 	char *rootdir;
 	const char *myname;
 	alpm_handle_t *handle;
 	char delimiter[SEP_LEN+1];
 	unsigned short aur;
 	bool aur_foreign;
+	unsigned int aur_jobs;
 	bool aur_maintainer;
 	bool aur_upgrades;
+	unsigned int cache_ttl;
 	bool colors;
 	bool custom_out;
 	unsigned short db_local;
@@ -139,6 +150,7 @@ typedef struct _aq_config
 	qtype_t query;
 	bool quiet;
 	bool show_size;
+	bool stats;
 	stype_t sort;
 	bool rsort;
 } aq_config;
@@ -188,6 +200,39 @@ bool target_arg_add (target_arg_t *t, const char *s, void *item);
 alpm_list_t *target_arg_clear (const target_arg_t *t, alpm_list_t *targets);
 alpm_list_t *target_arg_close (target_arg_t *t, alpm_list_t *targets);
 
+/*
+ * Arena allocator
+ * Memory is zeroed and released all at once by arena_free().
+ */
+typedef struct _arena_t arena_t;
+
+arena_t *arena_new (void);
+void *arena_alloc (arena_t *arena, size_t size);
+char *arena_strndup (arena_t *arena, const char *s, size_t n);
+void arena_free (arena_t *arena);
+/* arena_list_add() is alpm_list_add() in arena, list must not be freed */
+alpm_list_t *arena_list_add (arena_t *arena, alpm_list_t *list, void *data);
+
+/*
+ * Hash table with string keys
+ * Keys and data are not copied nor freed by the table.
+ */
+typedef struct _hash_t hash_t;
+
+/* str_hash() is FNV-1a */
+unsigned long long str_hash (const char *s);
+/* size is a hint of the number of keys, the table grows as needed */
+hash_t *hash_new (size_t size);
+void hash_free (hash_t *hash);
+/* hash_add() replaces data of an existing key */
+void hash_add (hash_t *hash, const char *key, void *data);
+void *hash_get (const hash_t *hash, const char *key);
+/* hash_new_ptr() makes a table keyed by pointers, use hash_*_ptr() with it */
+hash_t *hash_new_ptr (size_t size);
+void hash_add_ptr (hash_t *hash, const void *key, void *data);
+void *hash_get_ptr (const hash_t *hash, const void *key);
+size_t hash_count (const hash_t *hash);
+
 /*
  * String helper
  */
@@ -200,6 +245,8 @@ typedef struct _string_t
 
 string_t *string_new (void);
 void string_free (string_t *dest);
+/* string_free2() frees dest but returns its content */
+char *string_free2 (string_t *dest);
 void string_ncat (string_t *dest, const char *src, size_t n);
 void string_cat (string_t *dest, const char *src);
 const char *string_cstr (const string_t *str);
@@ -224,27 +271,86 @@ char *ttostr (time_t t);
  */
 typedef const char *(*printpkgfn)(const void *, unsigned char);
 void format_str (char *s);
-char *pkg_to_str (const char *target, const void *pkg, printpkgfn f, const char *format);
+/* format_new() compiles a -f format, once for all packages */
+format_t *format_new (const char *format);
+void format_free (format_t *fmt);
+/* pkg_to_str() returns pkg as formatted by fmt,
+ * the string belongs to fmt and is overwritten by the next call.
+ */
+const char *pkg_to_str (format_t *fmt, const char *target, const void *pkg, printpkgfn f);
+/* format_has_field() returns true if custom output uses %c */
+bool format_has_field (unsigned char c);
 void print_package (const char *target, const void *pkg, printpkgfn f);
 
 /* Results */
 void calculate_results_relevance (const alpm_list_t *targets);
-void print_or_add_result (const void *pkg, pkgtype_t type);
+/* print_or_add_result() takes ownership of AUR packages */
+void print_or_add_result (void *pkg, pkgtype_t type);
+/* results_mark() and results_sort_since() sort the results added since
+ * mark with fn_cmp, equal ones last added first, as if they had been
+ * collected with alpm_list_add_sorted() before being added */
+size_t results_mark (void);
+void results_sort_since (size_t mark, alpm_list_fn_cmp fn_cmp);
+/* results_rollback() drops (and frees) the results added since mark */
+void results_rollback (size_t mark);
 void show_results (void);
 
 /* Utils */
 /* mbasename is from pacman's code */
 const char *mbasename (const char *path);
+/* threads_run() calls fn on consecutive chunks of count items, on
+ * count / per_thread threads at most (this one included, up to 8)
+ */
+typedef void (*threads_fn)(void *data, size_t start, size_t count);
+void threads_run (size_t count, size_t per_thread, threads_fn fn, void *data);
 
-/* Returns true if package name contains all targets; false otherwise */
-/* use_regex: true for AUR search, false for pacman search */
-bool does_name_contain_targets (const alpm_list_t *targets, const char *name, bool use_regex);
+/*
+ * Target matcher
+ * Targets are compiled once, those without regex metacharacters
+ * are matched as plain strings if the locale folds ASCII only,
+ * one or two of them in a single SSE2 pass. Case is ignored.
+ */
+typedef struct _matcher_t matcher_t;
+
+/* use_regex: true for pacman search, false for AUR search */
+matcher_t *matcher_new (const alpm_list_t *targets, bool use_regex);
+void matcher_free (matcher_t *matcher);
+/* matcher_match() returns true if each target is in name or desc (may be NULL) */
+bool matcher_match (const matcher_t *matcher, const char *name, const char *desc);
+/* matcher_match_pkg() matches like alpm_db_search(): each target is in name
+ * (as regex or plain text), desc, or a name of provides or groups.
+ * It doesn't call alpm, so it's safe in worker threads.
+ */
+bool matcher_match_pkg (const matcher_t *matcher, const char *name, const char *desc,
+                        const alpm_list_t *provides, const alpm_list_t *groups);
 
 /*
  * curl helper
  */
 CURL *curl_init (long flags);
 char *curl_fetch (CURL *curl, const char *url);
+/* curl_fetch_stream() hands the body to fn chunk by chunk as it's received.
+ * fn returns false to ignore the rest of the body.
+ */
+typedef bool (*curl_stream_fn)(const char *data, size_t len, void *userdata);
+/* Responses are kept in config.cache_dir (--aur-cache):
+ * CACHE_REVALIDATE ones are served for config.cache_ttl seconds then revalidated,
+ * CACHE_KEEP bodies are kept as long as they are requested with the same version.
+ */
+typedef enum {
+	CACHE_OFF,
+	CACHE_REVALIDATE,
+	CACHE_KEEP
+} cachemode_t;
+bool curl_fetch_stream (CURL *curl, const char *url, curl_stream_fn fn, void *data, cachemode_t cache);
+/* curl_multi_fetch() fetches urls concurrently, at most max_conn at a time.
+ * versions (may be NULL) gives the CACHE_KEEP version of each url.
+ * Returns bodies in urls order (NULL data for failed transfers),
+ * or NULL if the multi handle can't be set up.
+ */
+alpm_list_t *curl_multi_fetch (CURL *curl, const alpm_list_t *urls, long max_conn,
+		cachemode_t cache, const alpm_list_t *versions);
+void cache_print_stats (void);
 void curl_cleanup (void);
 
 #endif
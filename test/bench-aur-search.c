@@ -0,0 +1,148 @@
+/*
+ *  bench-aur-search.c
+ *
+ *  Copyright (c) 2026 package-query contributors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Parses a large type=search response.
+ * Usage: bench-aur-search [response.json]
+ * Without a file, the response is SYNTHETIC: BENCH_PKGS packages shaped
+ * like RPC v5 search results, in an order unrelated to their names.
+ * A recorded one can be saved with
+ *   curl -o response.json 'https://aur.archlinux.org/rpc/?v=5&type=search&arg=python'
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aur.h"
+#include "test.h"
+
+#define BENCH_PKGS 5000
+#define BENCH_ROUNDS 5
+
+static char *synthetic_response (unsigned int count)
+{
+	string_t *res = string_new ();
+	char buf[1024];
+	snprintf (buf, sizeof (buf),
+			"{\"resultcount\":%u,\"results\":[", count);
+	string_cat (res, buf);
+	for (unsigned int i = 0; i < count; i++) {
+		/* 7919 is prime, names come in a scattered order */
+		const unsigned int n = (unsigned int) ((i * 7919ULL) % count);
+		snprintf (buf, sizeof (buf),
+				"%s{\"ID\":%u,\"Name\":\"python-synthetic-%05u\",\"PackageBaseID\":%u,"
+				"\"PackageBase\":\"python-synthetic-%05u\",\"Version\":\"1.%u.0-1\","
+				"\"Description\":\"Synthetic package %u for the search parsing benchmark\","
+				"\"URL\":\"https://example.org/p%u\",\"NumVotes\":%u,\"Popularity\":%u.%02u,"
+				"\"OutOfDate\":null,\"Maintainer\":\"maint%u\",\"FirstSubmitted\":1400000000,"
+				"\"LastModified\":%u,\"URLPath\":\"/cgit/aur.git/snapshot/python-synthetic-%05u.tar.gz\"}",
+				(i) ? "," : "", 100000 + n, n, 100000 + n, n, n % 10, n, n, n % 500,
+				n % 7, n % 100, n % 300, 1500000000 + n, n);
+		string_cat (res, buf);
+	}
+	string_cat (res, "],\"type\":\"search\",\"version\":5}");
+	return string_free2 (res);
+}
+
+static char *read_file (const char *path)
+{
+	FILE *fp = fopen (path, "r");
+	if (!fp) {
+		perror (path);
+		return NULL;
+	}
+	string_t *res = string_new ();
+	char buf[65536];
+	size_t len;
+	while ((len = fread (buf, 1, sizeof (buf), fp)) > 0) {
+		string_ncat (res, buf, len);
+	}
+	fclose (fp);
+	return string_free2 (res);
+}
+
+static int name_cmp (const void *p1, const void *p2)
+{
+	return strcmp (aur_pkg_get_name (p1), aur_pkg_get_name (p2));
+}
+
+int main (int argc, char **argv)
+{
+	char *body = (argc > 1) ? read_file (argv[1]) : synthetic_response (BENCH_PKGS);
+	if (!body) {
+		return 1;
+	}
+	printf ("%s response, %zu bytes\n", (argc > 1) ? argv[1] : "synthetic", strlen (body));
+
+	alpm_list_t *pkgs = NULL;
+	double best = 0;
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		alpm_list_free_inner (pkgs, (alpm_list_fn_free) aur_pkg_free);
+		alpm_list_free (pkgs);
+		const double start = now_ms ();
+		pkgs = aur_json_parse (strdup (body), NULL);
+		const double elapsed = now_ms () - start;
+		if (!round || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	const size_t count = alpm_list_count (pkgs);
+	printf ("aur_json_parse: %zu packages in %.2f ms\n", count, best);
+
+	/* the sort alone, on the same packages in a fixed shuffled order:
+	 * sorted insertion (before) against one merge sort (now) */
+	void **shuffled;
+	CALLOC (shuffled, count + 1, sizeof (void *));
+	size_t k = 0;
+	for (const alpm_list_t *p = pkgs; p; p = alpm_list_next (p)) {
+		shuffled[k++] = p->data;
+	}
+	srand (1);
+	for (size_t i = count; i > 1; i--) {
+		const size_t j = (size_t) rand () % i;
+		void *tmp = shuffled[i-1];
+		shuffled[i-1] = shuffled[j];
+		shuffled[j] = tmp;
+	}
+
+	double start = now_ms ();
+	alpm_list_t *sorted = NULL;
+	for (size_t i = 0; i < count; i++) {
+		sorted = alpm_list_add_sorted (sorted, shuffled[i], name_cmp);
+	}
+	printf ("alpm_list_add_sorted: %.2f ms\n", now_ms () - start);
+	alpm_list_free (sorted);
+
+	start = now_ms ();
+	sorted = NULL;
+	for (size_t i = 0; i < count; i++) {
+		sorted = alpm_list_add (sorted, shuffled[i]);
+	}
+	sorted = alpm_list_msort (sorted, count, name_cmp);
+	printf ("alpm_list_add + alpm_list_msort: %.2f ms\n", now_ms () - start);
+	alpm_list_free (sorted);
+
+	free (shuffled);
+	alpm_list_free_inner (pkgs, (alpm_list_fn_free) aur_pkg_free);
+	alpm_list_free (pkgs);
+	free (body);
+	return 0;
+}
+
+/* vim: set ts=4 sw=4 noet: */
@@ -0,0 +1,105 @@
+/*
+ *  bench-concat.c
+ *
+ *  Copyright (c) 2026 package-query contributors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * %F and list fields on a SYNTHETIC file list of BENCH_FILES entries.
+ * The strcat() loop they used to be is timed on the first
+ * BENCH_STRCAT_FILES entries only, it's quadratic.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#define BENCH_FILES 100000
+#define BENCH_STRCAT_FILES 10000
+
+/* strcat_list() is how concat_str_list() used to append */
+static char *strcat_list (const alpm_list_t *l, size_t max)
+{
+	size_t len = 1;
+	size_t n = 0;
+	for (const alpm_list_t *i = l; i && n < max; i = alpm_list_next (i), n++) {
+		len += strlen (i->data) + strlen (config.delimiter);
+	}
+	char *ret;
+	CALLOC (ret, len, sizeof (char));
+	n = 0;
+	for (const alpm_list_t *i = l; i && n < max; i = alpm_list_next (i), n++) {
+		if (n) {
+			strcat (ret, config.delimiter);
+		}
+		strcat (ret, i->data);
+	}
+	return ret;
+}
+
+int main (void)
+{
+	strcpy (config.delimiter, " ");
+
+	alpm_filelist_t files;
+	files.count = BENCH_FILES;
+	CALLOC (files.files, files.count, sizeof (alpm_file_t));
+	alpm_list_t *names = NULL;
+	for (size_t i = 0; i < files.count; i++) {
+		if (asprintf (&(files.files[i].name), "usr/share/pq-bench/dir%03zu/file-%06zu.txt",
+				i / 1000, i) < 0) {
+			return 1;
+		}
+		names = alpm_list_add (names, files.files[i].name);
+	}
+	printf ("%zu synthetic file names\n", files.count);
+
+	double start = now_ms ();
+	char *s = concat_file_list (&files);
+	printf ("concat_file_list: %zu bytes in %.2f ms\n", strlen (s), now_ms () - start);
+	free (s);
+
+	start = now_ms ();
+	s = concat_str_list (names);
+	printf ("concat_str_list: %zu bytes in %.2f ms\n", strlen (s), now_ms () - start);
+	free (s);
+
+	start = now_ms ();
+	string_t *str = string_new ();
+	for (const alpm_list_t *i = names; i; i = alpm_list_next (i)) {
+		string_cat (str, i->data);
+		string_cat (str, config.delimiter);
+	}
+	s = string_free2 (str);
+	printf ("string_cat: %zu bytes in %.2f ms\n", strlen (s), now_ms () - start);
+	free (s);
+
+	start = now_ms ();
+	s = strcat_list (names, BENCH_STRCAT_FILES);
+	printf ("strcat loop, first %d files only: %zu bytes in %.2f ms\n",
+			BENCH_STRCAT_FILES, strlen (s), now_ms () - start);
+	free (s);
+
+	alpm_list_free (names);
+	for (size_t i = 0; i < files.count; i++) {
+		free (files.files[i].name);
+	}
+	free (files.files);
+	return 0;
+}
+
+/* vim: set ts=4 sw=4 noet: */
@@ -0,0 +1,163 @@
+/*
+ *  bench-matcher.c
+ *
+ *  Copyright (c) 2026 package-query contributors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * matcher_match() against one strcasestr() per target.
+ * Usage: bench-matcher [descriptions.txt [target...]]
+ * descriptions.txt has one description per line, real ones can be
+ * listed with: expac -S '%d' > descriptions.txt
+ * Without it, descriptions are SYNTHETIC sentences made of common words.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#define BENCH_DESCS 20000
+#define BENCH_ROUNDS 20
+
+static const char *words[] = {
+	"A", "library", "for", "the", "Python", "bindings", "to", "and", "of",
+	"GTK", "client", "Qt", "fast", "simple", "command", "line", "tool",
+	"written", "in", "Rust", "plugin", "support", "with", "KDE", "GNOME",
+	"lightweight", "terminal", "emulator", "font", "theme", "icon", "driver",
+	"daemon", "manager", "(git", "version)", "based", "on", "open", "source"
+};
+#define WORDS (sizeof (words) / sizeof (words[0]))
+
+static alpm_list_t *synthetic_descs (void)
+{
+	alpm_list_t *descs = NULL;
+	srand (1);
+	for (int i = 0; i < BENCH_DESCS; i++) {
+		string_t *desc = string_new ();
+		const int count = 4 + rand () % 10;
+		for (int w = 0; w < count; w++) {
+			if (w) {
+				string_cat (desc, " ");
+			}
+			string_cat (desc, words[rand () % WORDS]);
+		}
+		descs = alpm_list_add (descs, string_free2 (desc));
+	}
+	return descs;
+}
+
+static alpm_list_t *read_descs (const char *path)
+{
+	FILE *fp = fopen (path, "r");
+	if (!fp) {
+		perror (path);
+		return NULL;
+	}
+	alpm_list_t *descs = NULL;
+	char *line = NULL;
+	size_t n = 0;
+	ssize_t len;
+	while ((len = getline (&line, &n, fp)) > 0) {
+		if (line[len-1] == '\n') {
+			line[len-1] = '\0';
+		}
+		descs = alpm_list_add (descs, strdup (line));
+	}
+	free (line);
+	fclose (fp);
+	return descs;
+}
+
+static unsigned int by_strcasestr (const alpm_list_t *descs, const alpm_list_t *targets)
+{
+	unsigned int found = 0;
+	for (const alpm_list_t *d = descs; d; d = alpm_list_next (d)) {
+		const alpm_list_t *t;
+		for (t = targets; t && strcasestr (d->data, t->data); t = alpm_list_next (t));
+		found += (t == NULL);
+	}
+	return found;
+}
+
+static unsigned int by_matcher (const alpm_list_t *descs, const matcher_t *matcher)
+{
+	unsigned int found = 0;
+	for (const alpm_list_t *d = descs; d; d = alpm_list_next (d)) {
+		found += matcher_match (matcher, d->data, NULL);
+	}
+	return found;
+}
+
+static void report (const char *what, double ms, size_t count, unsigned int found)
+{
+	printf ("%-24s %8.1f ns/description, %u found\n", what, ms * 1e6 / count, found);
+}
+
+int main (int argc, char **argv)
+{
+	alpm_list_t *descs = (argc > 1) ? read_descs (argv[1]) : synthetic_descs ();
+	const size_t count = alpm_list_count (descs);
+	if (!count) {
+		return 1;
+	}
+
+	alpm_list_t *targets = NULL;
+	if (argc > 2) {
+		for (int i = 2; i < argc; i++) {
+			targets = alpm_list_add (targets, argv[i]);
+		}
+	} else {
+		targets = alpm_list_add (targets, "python");
+		targets = alpm_list_add (targets, "lib");
+	}
+	printf ("%zu %s descriptions, %zu targets\n", count,
+			(argc > 1) ? argv[1] : "synthetic", alpm_list_count (targets));
+
+	matcher_t *scan = matcher_new (targets, false);
+	matcher_t *plain = matcher_new (targets, false);
+	matcher_no_scan (plain);
+
+	unsigned int found[3] = {0, 0, 0};
+	double best[3] = {0, 0, 0};
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		double elapsed[3], start = now_ms ();
+		found[0] = by_strcasestr (descs, targets);
+		elapsed[0] = now_ms () - start;
+		start = now_ms ();
+		found[1] = by_matcher (descs, plain);
+		elapsed[1] = now_ms () - start;
+		start = now_ms ();
+		found[2] = by_matcher (descs, scan);
+		elapsed[2] = now_ms () - start;
+		for (int k = 0; k < 3; k++) {
+			if (!round || elapsed[k] < best[k]) {
+				best[k] = elapsed[k];
+			}
+		}
+	}
+	report ("strcasestr", best[0], count, found[0]);
+	report ("matcher_match (no scan)", best[1], count, found[1]);
+	report ("matcher_match", best[2], count, found[2]);
+
+	matcher_free (scan);
+	matcher_free (plain);
+	alpm_list_free (targets);
+	FREELIST (descs);
+	return (found[0] == found[1] && found[0] == found[2]) ? 0 : 1;
+}
+
+/* vim: set ts=4 sw=4 noet: */
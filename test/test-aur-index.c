@@ -0,0 +1,130 @@
+/*
+ *  test-aur-index.c
+ *
+ *  Copyright (c) 2026 package-query contributors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * aur_import() -> aur_index_open() -> lookups, on aur-dump.json:
+ * a hand written dump in the format of packages-meta-ext-v1.json.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aur.h"
+#include "aur-index.h"
+#include "test.h"
+
+static bool str_eq (const char *s1, const char *s2)
+{
+	return s1 && s2 && strcmp (s1, s2) == 0;
+}
+
+static bool list_eq (const alpm_list_t *list, const char **expected)
+{
+	for (; *expected; expected++, list = alpm_list_next (list)) {
+		if (!list || !str_eq (list->data, *expected)) {
+			return false;
+		}
+	}
+	return list == NULL;
+}
+
+int main (void)
+{
+	char index[] = "/tmp/pq-test-index.XXXXXX";
+	const int fd = mkstemp (index);
+	if (fd < 0) {
+		perror ("mkstemp");
+		return 1;
+	}
+	close (fd);
+
+	CHECK (aur_import (TEST_SRCDIR "/aur-dump.json", index));
+	aurindex_t *idx = aur_index_open (index);
+	CHECK (idx != NULL);
+	if (!idx) {
+		unlink (index);
+		return 1;
+	}
+
+	/* sorted by name */
+	static const char *names[] = { "pq-test", "pq-test-docs", "pq-test-git", "zsh-pq-theme", NULL };
+	CHECK (aur_index_count (idx) == 4);
+	for (size_t i = 0; names[i]; i++) {
+		CHECK (str_eq (aur_index_name (idx, i), names[i]));
+	}
+	CHECK (aur_index_name (idx, 4) == NULL);
+
+	aurpkg_t *pkg = aur_index_find (idx, "pq-test");
+	CHECK (pkg != NULL);
+	if (pkg) {
+		static const char *depends[] = { "glibc", "curl>=7.30", NULL };
+		static const char *provides[] = { "pq", NULL };
+		CHECK (str_eq (pkg->name, "pq-test"));
+		CHECK (str_eq (pkg->pkgbase, "pq-test"));
+		CHECK (str_eq (pkg->version, "1.2.3-1"));
+		CHECK (str_eq (pkg->desc, "Package used by package-query tests"));
+		CHECK (str_eq (pkg->maintainer, "alice"));
+		CHECK (str_eq (pkg->urlpath, "/cgit/aur.git/snapshot/pq-test.tar.gz"));
+		CHECK (list_eq (pkg->depends, depends));
+		CHECK (list_eq (pkg->provides, provides));
+		CHECK (pkg->groups == NULL);
+		CHECK (pkg->id == 1101);
+		CHECK (pkg->pkgbase_id == 501);
+		CHECK (pkg->votes == 42);
+		CHECK (pkg->popularity == 1.5);
+		CHECK (!pkg->outofdate);
+		CHECK (pkg->firstsubmit == 1500000000);
+		CHECK (pkg->lastmod == 1690000000);
+		aur_pkg_free (pkg);
+	}
+
+	/* orphan, out of date */
+	pkg = aur_index_find (idx, "zsh-pq-theme");
+	CHECK (pkg != NULL);
+	if (pkg) {
+		CHECK (pkg->maintainer == NULL);
+		CHECK (pkg->outofdate);
+		CHECK (pkg->votes == 3);
+		aur_pkg_free (pkg);
+	}
+	CHECK (aur_index_maintainer (idx, 3) == NULL);
+	CHECK (str_eq (aur_index_desc (idx, 1), "Documentation of pq-test"));
+
+	/* provides are not names */
+	CHECK (aur_index_find (idx, "pq") == NULL);
+	CHECK (aur_index_find (idx, "pq-test-") == NULL);
+	CHECK (aur_index_find (idx, "") == NULL);
+	aur_index_close (idx);
+
+	/* a truncated index is rejected */
+	FILE *fp = fopen (index, "r+");
+	CHECK (fp != NULL);
+	if (fp) {
+		fseek (fp, 0, SEEK_END);
+		CHECK (ftruncate (fileno (fp), ftell (fp) - 1) == 0);
+		fclose (fp);
+		CHECK (aur_index_open (index) == NULL);
+	}
+
+	unlink (index);
+	return test_status ();
+}
+
+/* vim: set ts=4 sw=4 noet: */
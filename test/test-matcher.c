@@ -0,0 +1,134 @@
+/*
+ *  test-matcher.c
+ *
+ *  Copyright (c) 2026 package-query contributors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * matcher_match() on literals, with literal_scan() and without it,
+ * against strcasestr() on random strings.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "test.h"
+
+#define ROUNDS 50000
+
+/* few letters, so that targets are often found */
+static const char alphabet[] = "aAbBcCxX-. \xc3\xa9\xff";
+
+static unsigned int seed = 1;
+
+static unsigned int next_rand (void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+static void random_str (char *s, size_t max_len)
+{
+	const size_t len = next_rand () % (max_len + 1);
+	for (size_t i = 0; i < len; i++) {
+		s[i] = alphabet[next_rand () % (sizeof (alphabet) - 1)];
+	}
+	s[len] = '\0';
+}
+
+static bool reference_match (const alpm_list_t *targets, const char *name, const char *desc)
+{
+	for (const alpm_list_t *t = targets; t; t = alpm_list_next (t)) {
+		if (!strcasestr (name, t->data) && (!desc || !strcasestr (desc, t->data))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* check() compares both paths of matcher_match() with strcasestr() */
+static void check (const alpm_list_t *targets, const char *name, const char *desc)
+{
+	matcher_t *scan = matcher_new (targets, false);
+	matcher_t *plain = matcher_new (targets, false);
+	matcher_no_scan (plain);
+	const bool expected = reference_match (targets, name, desc);
+	const bool scan_found = matcher_match (scan, name, desc);
+	const bool plain_found = matcher_match (plain, name, desc);
+	if (scan_found != expected || plain_found != expected) {
+		fprintf (stderr, "name '%s' desc '%s' first target '%s': expected %d, scan %d, strcasestr %d\n",
+				name, (desc) ? desc : "(null)", (const char *) targets->data,
+				expected, scan_found, plain_found);
+		test_failures++;
+	}
+	matcher_free (scan);
+	matcher_free (plain);
+}
+
+int main (void)
+{
+	/* strings end right before a page that can't be read */
+	const long page = sysconf (_SC_PAGESIZE);
+	char *guard = mmap (NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	CHECK (guard != MAP_FAILED);
+	if (guard == MAP_FAILED) {
+		return 1;
+	}
+	CHECK (mprotect (guard + page, page, PROT_NONE) == 0);
+
+	char name[64], desc[128], targets_str[3][8];
+	for (int round = 0; round < ROUNDS; round++) {
+		alpm_list_t *targets = NULL;
+		const unsigned int count = 1 + next_rand () % 3;
+		for (unsigned int i = 0; i < count; i++) {
+			do {
+				random_str (targets_str[i], 4);
+			} while (!targets_str[i][0]);
+			targets = alpm_list_add (targets, targets_str[i]);
+		}
+		random_str (name, 40);
+		random_str (desc, 100);
+
+		/* every alignment, and against the guard page */
+		const size_t len = strlen (name);
+		char *moved = guard + page - len - 1 - (size_t) (round % 16);
+		memcpy (moved, name, len + 1);
+		check (targets, moved, (round % 5) ? desc : NULL);
+		moved = guard + page - len - 1;
+		memcpy (moved, name, len + 1);
+		check (targets, moved, desc);
+
+		alpm_list_free (targets);
+	}
+
+	/* more literals than literal_scan() takes */
+	alpm_list_t *targets = NULL;
+	static const char *letters[] = { "a", "b", "c", "d", "E", "f", "g", "h", "i", "j", NULL };
+	for (const char **l = letters; *l; l++) {
+		targets = alpm_list_add (targets, (void *) *l);
+	}
+	check (targets, "abcdefghij", NULL);
+	check (targets, "ABCDE", "fghij");
+	check (targets, "abcdefghi", "");
+	alpm_list_free (targets);
+
+	munmap (guard, 2 * page);
+	return test_status ();
+}
+
+/* vim: set ts=4 sw=4 noet: */
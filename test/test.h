@@ -0,0 +1,49 @@
+/*
+ *  test.h
+ *
+ *  Copyright (c) 2026 package-query contributors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PQ_TEST_H
+#define PQ_TEST_H
+#include <stdio.h>
+
+#include "util.h"
+
+/*
+ * Shared by test and bench programs, see test.c.
+ * They link libpackagequery without package-query.c, test.c defines config.
+ */
+
+/* CHECK() reports a failed condition, test_status() is the exit status */
+extern int test_failures;
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		test_failures++; \
+	} \
+} while (0)
+int test_status (void);
+
+/* now_ms() is a monotonic clock for benchmarks */
+double now_ms (void);
+
+/* Test hooks in src/, not in their public headers */
+/* matcher_no_scan() matches literals one by one with strcasestr () */
+void matcher_no_scan (matcher_t *matcher);
+
+#endif
+
+/* vim: set ts=4 sw=4 noet: */